@@ -1,13 +1,24 @@
 #ifndef __COMMON_H__
 #define __COMMON_H__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE                 /* epoll, signalfd and friends */
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <signal.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/pidfd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 
 /******************************************************************************
  * Exrternal variables
@@ -98,6 +109,93 @@ void Setpgid(pid_t pid, pid_t pgid);
 pid_t Getpgrp(void);
 
 
+/******************************************************************************
+ * Wrappers for Linux pidfd functions.
+ ******************************************************************************/
+int Pidfd_open(pid_t pid, unsigned int flags);
+void Pidfd_send_signal(int pidfd, int sig, siginfo_t *info, unsigned int flags);
+int Poll(struct pollfd *fds, nfds_t nfds, int timeout);
+
+
+/******************************************************************************
+ * Child handles.
+ *
+ * A child_t names one child process through a pidfd. Unlike a bare pid,
+ * the pidfd can never come to refer to another process, so signalling
+ * through it is free of pid-reuse races. The pidfd becomes readable when
+ * the child terminates, so it can be polled together with other fds
+ * (e.g. added to an ev_loop_t with ev_add_fd) or waited on with a timeout.
+ *
+ * All child_ functions terminate the process via unix_error on failure.
+ ******************************************************************************/
+typedef struct {
+    pid_t pid;          /* Process id of the child */
+    int fd;             /* pidfd referring to the child, -1 once closed */
+    int status;         /* Wait status, valid once reaped */
+    int reaped;         /* Has the child been reaped? */
+} child_t;
+
+/**
+ * child_fork - Like Fork, but also opens a handle on the new child.
+ * Uses clone3(CLONE_PIDFD) so the pidfd is created atomically with the
+ * process, falling back to fork + pidfd_open on older kernels.
+ *
+ * @return 0 in the child, the child's pid in the parent.
+ */
+pid_t child_fork(child_t *c);
+
+/**
+ * child_wait - Waits at most @timeout milliseconds (-1 = forever) for the
+ * child to terminate and reaps it, storing its wait status in c->status.
+ * A signal caught meanwhile does not cut the wait short.
+ *
+ * @return 1 if the child was reaped, 0 on timeout.
+ */
+int child_wait(child_t *c, int timeout);
+
+/**
+ * child_wait_any - Waits at most @timeout milliseconds for any of the @n
+ * children in @cs that are not reaped yet, and reaps one of them, through
+ * signals like child_wait.
+ *
+ * @return the index of the reaped child, or -1 on timeout or if every
+ * child has already been reaped.
+ */
+int child_wait_any(child_t *cs, int n, int timeout);
+
+/**
+ * child_kill - Sends @signum to the child. Does nothing if the child has
+ * already been reaped.
+ */
+void child_kill(child_t *c, int signum);
+
+/**
+ * child_close - Closes the child's pidfd. Does not reap the child.
+ */
+void child_close(child_t *c);
+
+
+/******************************************************************************
+ * Batch reaping.
+ ******************************************************************************/
+typedef struct {
+    pid_t pid;                  /* Reaped child */
+    int status;                 /* Its wait status */
+    struct rusage rusage;       /* Resources it used */
+} reap_t;
+
+/**
+ * reap_batch - Reaps, without blocking, up to @n children that have
+ * already terminated and stores their pid, wait status and resource
+ * usage in @rs. Async-signal-safe. Callers with many children should
+ * call it until it returns less than @n.
+ *
+ * @return the number of children reaped, 0 if none is ready or there
+ * are no children at all.
+ */
+int reap_batch(reap_t *rs, int n);
+
+
 /******************************************************************************
  * Wrappers for Unix signal functions.
  * use: man func_name to figure out corresponding definition.
@@ -112,6 +210,34 @@ void Sigdelset(sigset_t *set, int signum);
 int Sigismember(const sigset_t *set, int signum);
 int Sigsuspend(const sigset_t *set);
 
+/**
+ * Signal_info - Like Signal, for a SA_SIGINFO handler, which gets the
+ * sender (si_pid), the cause (si_code) and, for a queued signal, its
+ * payload (si_value).
+ */
+typedef void siginfo_handler_t(int, siginfo_t *, void *);
+siginfo_handler_t *Signal_info(int signum, siginfo_handler_t *handler);
+
+/**
+ * Sigqueue - Sends @signum with @value to @pid. Real-time signals queue:
+ * each one sent is delivered once, in order, with its own payload, where
+ * a standard signal already pending is merged with the new one.
+ */
+void Sigqueue(pid_t pid, int signum, const union sigval value);
+
+/**
+ * Sigwaitinfo - Like sigwaitinfo, but an interrupted wait is retried.
+ *
+ * @return the signal taken.
+ */
+int Sigwaitinfo(const sigset_t *set, siginfo_t *info);
+
+/**
+ * Sigrt - Returns real-time signal SIGRTMIN + @n, exits if there is no
+ * such signal (n < 0 or beyond SIGRTMAX).
+ */
+int Sigrt(int n);
+
 
 /******************************************************************************
  * Signal-safe I/O routines.
@@ -136,7 +262,167 @@ char *Fgets(char *str, int size, FILE *stream);
 /******************************************************************************
  * Wrappers for Unix I/O routines.
  ******************************************************************************/
+int Open(const char *pathname, int flags, mode_t mode);
 ssize_t Read(int fd, void *buf, size_t nbyte);
+void Close(int fd);
+int Dup2(int fd1, int fd2);
+void Pipe(int fds[2]);
+
+/******************************************************************************
+ * Zero-copy transfers.
+ ******************************************************************************/
+#define SPLICE_CHUNK (1 << 20)      /* Bytes moved per splice, pipe size */
+
+/**
+ * splice_copy - Moves everything from @in to @out until EOF. When either
+ * side is a pipe the data is moved with splice and never passes through
+ * user space; otherwise it falls back to read/write.
+ */
+void splice_copy(int in, int out);
+
+/**
+ * tee_copy - Moves everything from pipe @in to pipe @out until EOF and
+ * also writes a copy of it to @fd. The pipe-to-pipe copy is done with
+ * tee and the copy to @fd with splice, no byte is copied to user space.
+ * Falls back to read/write if @in or @out is not a pipe.
+ */
+void tee_copy(int in, int out, int fd);
+
+/******************************************************************************
+ * Wrappers for Linux event notification functions.
+ ******************************************************************************/
+int Epoll_create1(int flags);
+void Epoll_ctl(int epfd, int op, int fd, struct epoll_event *event);
+int Epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout);
+int Signalfd(int fd, const sigset_t *mask, int flags);
+
+/******************************************************************************
+ * Rio (Robust I/O) package.
+ ******************************************************************************/
+#define RIO_BUFSIZE (65536)        /* Large reads for script input */
+typedef struct {
+    int rio_fd;                 /* Descriptor for this internal buffer */
+    int rio_cnt;                /* Unread bytes in internal buffer */
+    char *rio_bufptr;           /* Next unread byte in internal buffer */
+    char rio_buf[RIO_BUFSIZE];  /* Internal buffer */
+} rio_t;
+
+ssize_t rio_readn(int fd, void *usrbuf, size_t n);
+ssize_t rio_writen(int fd, void *usrbuf, size_t n);
+void rio_readinitb(rio_t *rp, int fd);
+ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n);
+ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+
+/******************************************************************************
+ * Rio wrappers.
+ ******************************************************************************/
+ssize_t Rio_readn(int fd, void *usrbuf, size_t n);
+void Rio_writen(int fd, void *usrbuf, size_t n);
+void Rio_readinitb(rio_t *rp, int fd);
+ssize_t Rio_readnb(rio_t *rp, void *usrbuf, size_t n);
+ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+
+/******************************************************************************
+ * Event loop.
+ *
+ * A single-threaded loop that multiplexes file descriptors and signals
+ * through one epoll instance. Signals registered with ev_add_signal are
+ * blocked and read back from a signalfd, so their handlers run in normal
+ * context (printf, malloc, waitpid ... are all fine) instead of
+ * asynchronously. The loop sleeps in epoll_wait while there is nothing
+ * to do, there is no busy-waiting.
+ *
+ * All ev_ functions terminate the process via unix_error on failure.
+ ******************************************************************************/
+#define EV_READ     EPOLLIN
+#define EV_WRITE    EPOLLOUT
+#define EV_MAXEVENTS (64)           /* Max events dispatched per wakeup */
+
+typedef struct ev_loop ev_loop_t;
+typedef void ev_fd_handler_t(ev_loop_t *loop, int fd, unsigned int events,
+                             void *arg);
+typedef void ev_sig_handler_t(ev_loop_t *loop,
+                              const struct signalfd_siginfo *info, void *arg);
+
+typedef struct {
+    ev_fd_handler_t *handler;   /* NULL if fd is not watched */
+    void *arg;
+    unsigned int events;
+    int always_ready;           /* Regular file: epoll refuses it */
+} ev_watcher_t;
+
+struct ev_loop {
+    int epfd;                   /* The epoll instance */
+    int sigfd;                  /* signalfd for watched signals, or -1 */
+    sigset_t sigmask;           /* Signals routed through sigfd */
+    sigset_t prevmask;          /* Signal mask before ev_init */
+    ev_watcher_t *watchers;     /* Indexed by fd */
+    int nwatchers;              /* Capacity of watchers */
+    int nalways;                /* Number of always-ready watchers */
+    struct {
+        ev_sig_handler_t *handler;
+        void *arg;
+    } sigs[NSIG];
+    int done;                   /* Set by ev_stop */
+};
+
+/**
+ * ev_init - Initializes an empty event loop.
+ */
+void ev_init(ev_loop_t *loop);
+
+/**
+ * ev_add_fd - Calls @handler(loop, fd, events, arg) whenever @fd is ready
+ * for any of @events (EV_READ, EV_WRITE). Replaces any previous watcher
+ * on @fd. Regular files cannot be polled; they are treated as always
+ * ready.
+ */
+void ev_add_fd(ev_loop_t *loop, int fd, unsigned int events,
+               ev_fd_handler_t *handler, void *arg);
+
+/**
+ * ev_del_fd - Stops watching @fd. Does nothing if @fd is not watched.
+ */
+void ev_del_fd(ev_loop_t *loop, int fd);
+
+/**
+ * ev_add_signal - Blocks @signum and calls @handler(loop, info, arg) from
+ * the loop every time it is delivered. Like with ordinary handlers,
+ * several pending instances of a standard signal are coalesced into one.
+ */
+void ev_add_signal(ev_loop_t *loop, int signum, ev_sig_handler_t *handler,
+                   void *arg);
+
+/**
+ * ev_run_once - Waits at most @timeout milliseconds (-1 = forever) for
+ * events and dispatches them.
+ *
+ * @return the number of events dispatched.
+ */
+int ev_run_once(ev_loop_t *loop, int timeout);
+
+/**
+ * ev_run - Dispatches events until ev_stop is called.
+ */
+void ev_run(ev_loop_t *loop);
+
+/**
+ * ev_stop - Makes ev_run return after the current dispatch.
+ */
+void ev_stop(ev_loop_t *loop);
+
+/**
+ * ev_child_reset - Restores the signal mask that was in effect before
+ * ev_init. A forked child must call this before execve, otherwise the
+ * new program starts with the loop's signals blocked.
+ */
+void ev_child_reset(ev_loop_t *loop);
+
+/**
+ * ev_close - Releases all resources of the loop and restores the signal
+ * mask.
+ */
+void ev_close(ev_loop_t *loop);
 
 /******************************************************************************
  * Wrappers for dynamic storage allocation functions.
@@ -145,4 +431,517 @@ void *Malloc(size_t size);
 void *Realloc(void *ptr, size_t size);
 void *Calloc(size_t nmemb, size_t size);
 void Free(void *ptr);
+
+/******************************************************************************
+ * Command path cache.
+ *
+ * Resolves command names through the PATH directories and remembers the
+ * result in a hash table, like bash's hash builtin, so a command that has
+ * been run before costs no directory probing at all. The table is
+ * flushed automatically when PATH changes.
+ ******************************************************************************/
+#define PATH_HASHSIZE (256)         /* Number of hash buckets */
+
+/**
+ * path_lookup - Returns the file command @name runs: @name itself if it
+ * contains a slash, otherwise the first executable regular file @name in
+ * the PATH directories.
+ *
+ * @return the path, owned by the cache and valid until the entry is
+ * forgotten or the cache cleared, or NULL if the command is not found.
+ */
+char *path_lookup(char *name);
+
+/**
+ * path_forget - Drops @name from the cache, e.g. after executing its
+ * cached path failed.
+ */
+void path_forget(char *name);
+
+/**
+ * path_clear - Drops every entry of the cache.
+ */
+void path_clear(void);
+
+/**
+ * path_print - Prints the cached commands and how often each one was hit.
+ */
+void path_print(void);
+
+/******************************************************************************
+ * Command line tokenizer.
+ *
+ * Splits a command line into words and the operators < > | & in a single
+ * pass, in place: words are NUL-terminated inside the line itself, so
+ * nothing is copied except the bytes that quotes and escapes shift left.
+ * Runs of ordinary characters are skipped with one table lookup per byte.
+ * Words are separated by blanks and operators, and may be quoted:
+ *     'text'      literally text
+ *     "text"      text, where \" and \\ stand for a quote and a backslash
+ *     \c          the character c
+ * A word starting with # starts a comment that runs to the end of line.
+ ******************************************************************************/
+/* Token types */
+#define TOK_WORD 0
+#define TOK_IN 1                    /* < */
+#define TOK_OUT 2                   /* > */
+#define TOK_PIPE 3                  /* | */
+#define TOK_BG 4                    /* & */
+
+typedef struct {
+    int n;              /* Number of tokens */
+    int cap;            /* Room for cap tokens, plus a NULL */
+    char **argv;        /* Tokens, argv[n] is NULL */
+    int *types;         /* Their types */
+} tokens_t;
+
+/**
+ * tok_init - Makes @t an empty token list.
+ */
+void tok_init(tokens_t *t);
+
+/**
+ * tokenize - Tokenizes the command line @buf in place into @t, replacing
+ * its previous tokens. The argv and types arrays grow as needed, so the
+ * number of words is unlimited. Operator tokens point to static strings,
+ * the others into @buf.
+ *
+ * @return the number of tokens, or -1 if a quote is not closed.
+ */
+int tokenize(char *buf, tokens_t *t);
+
+/**
+ * tok_free - Frees the arrays of @t.
+ */
+void tok_free(tokens_t *t);
+
+/******************************************************************************
+ * Shell builtins.
+ *
+ * Commands simple enough to run inside the shell, without a fork or an
+ * exec. A shell keeps its builtins in a table sorted by name, which
+ * builtin_find searches, so each shell can add its own commands (jobs,
+ * fg, wait, ...) to the generic ones below. A builtin takes its argv like
+ * main and returns its exit status.
+ ******************************************************************************/
+typedef int builtin_fn_t(char **argv);
+
+typedef struct {
+    char *name;
+    builtin_fn_t *fn;
+} builtin_t;
+
+/**
+ * builtin_find - Looks up @name in @table, @n builtins sorted by name.
+ *
+ * @return the builtin, or NULL if @name is not one.
+ */
+builtin_t *builtin_find(builtin_t *table, int n, char *name);
+
+/**
+ * builtin_run - Runs builtin @fn with stdin from file @in and stdout to
+ * file @out, each unless NULL, then restores the shell's own stdin and
+ * stdout. Nothing is forked.
+ *
+ * @return the exit status of the builtin, 1 if a file cannot be opened.
+ */
+int builtin_run(builtin_fn_t *fn, char **argv, char *in, char *out);
+
+/**
+ * kill_signal - Parses the options of kill's @argv: -s sig, -sig or
+ * nothing for SIGTERM, where sig is a name with or without SIG, RTMIN+n,
+ * RTMAX-n or a number, and -q value to queue the signal with payload
+ * value. Stores the signal in @sigp and the payload in @queuep, NULL
+ * without -q.
+ *
+ * @return the first pid argument, or NULL after printing an error.
+ */
+char **kill_signal(char **argv, int *sigp, char **queuep);
+
+/**
+ * kill_send - Sends @signum to @pid with kill, or with sigqueue and
+ * payload @queue (a number) if not NULL. Only a single process can be
+ * queued a signal.
+ *
+ * @return 0, or -1 with errno set.
+ */
+int kill_send(pid_t pid, int signum, char *queue);
+
+/* Generic builtins */
+int builtin_echo(char **argv);      /* echo [-n] [arg ...] */
+int builtin_cd(char **argv);        /* cd [dir] */
+int builtin_pwd(char **argv);       /* pwd */
+int builtin_export(char **argv);    /* export [name[=value] ...] */
+int builtin_true(char **argv);      /* true */
+int builtin_false(char **argv);     /* false */
+int builtin_test(char **argv);      /* test expr, [ expr ] */
+int builtin_printf(char **argv);    /* printf format [arg ...] */
+int builtin_kill(char **argv);      /* kill [-s sig | -sig] [-q n] pid ... */
+
+/******************************************************************************
+ * Resource accounting.
+ *
+ * What a job costs, summed from the rusage wait4 returns for each of its
+ * processes: user and system CPU time, max RSS, page faults and context
+ * switches. The shells print it for the time builtin and can log it for
+ * every job, one line of key=value fields per job:
+ *     end=<epoch seconds> real=<s> user=<s> sys=<s> maxrss=<KB>
+ *     minflt=<n> majflt=<n> nvcsw=<n> nivcsw=<n> status=<n> cmd=<line>
+ * status is the shell's exit status: the exit code, or 128 + the signal
+ * that killed the job.
+ ******************************************************************************/
+/**
+ * clock_now - Returns the monotonic time in seconds.
+ */
+double clock_now(void);
+
+/**
+ * rusage_add - Adds the usage @ru of one more process to @sum, whose max
+ * RSS becomes the largest one.
+ */
+void rusage_add(struct rusage *sum, const struct rusage *ru);
+
+/**
+ * rusage_sub - Subtracts @start from @ru, e.g. to get what a builtin cost
+ * from getrusage before and after. The max RSS is left alone.
+ */
+void rusage_sub(struct rusage *ru, const struct rusage *start);
+
+/**
+ * rusage_print - Prints a time report of @ru and the elapsed time @real.
+ */
+void rusage_print(FILE *fp, double real, const struct rusage *ru);
+
+/**
+ * acct_open - Appends a line for every job to the log file @path from
+ * now on. Several shells can share a log.
+ */
+void acct_open(char *path);
+
+/**
+ * acct_log - Logs a job running @cmd (up to its first newline) that took
+ * @real seconds, used @ru and ended with wait status @status, if a log
+ * is open.
+ */
+void acct_log(char *cmd, int status, double real, const struct rusage *ru);
+
+/******************************************************************************
+ * Performance counters.
+ *
+ * What a region of code costs in hardware events, counted by the PMU with
+ * perf_event_open: cycles, instructions, L1 data cache and last level
+ * cache misses, data TLB misses, and page faults. The counters form one
+ * group, so they all count over the same intervals, in user space and, if
+ * allowed, kernel space. If the PMU cannot be used (a VM without one,
+ * perf_event_paranoid), the kernel's software counters are used instead:
+ * task clock, page faults, context switches and CPU migrations; and if
+ * perf_event_open is denied altogether, getrusage.
+ *
+ * Regions are named: each PERF_BEGIN/PERF_END pair adds to the totals of
+ * its name, which perf_report prints. A pair costs two system calls, so a
+ * region should enclose a phase of a benchmark, not one quick operation.
+ * Regions may nest but not recurse.
+ ******************************************************************************/
+#define PERF_MAX (6)            /* Counters in the group */
+
+typedef struct {
+    char *name;
+    long calls;                 /* Begin/end pairs */
+    double time;                /* Wall clock seconds inside */
+    double counts[PERF_MAX];    /* Totals of the counters */
+    double start_time;          /* Of the pair being timed */
+    double start[PERF_MAX];
+} perf_region_t;
+
+#define PERF_BEGIN(name) perf_begin(perf_region(name))
+#define PERF_END(name) perf_end(perf_region(name))
+
+/**
+ * perf_open - Opens the counters, if not open yet. If @children is set,
+ * they also count the children forked from now on, added in when they
+ * exit; each fork then copies the counters, which slows it down. The
+ * first perf_begin opens them with @children set.
+ *
+ * @return the number of counters.
+ */
+int perf_open(int children);
+
+/**
+ * perf_name - Returns the name of counter @i, or NULL past the last one.
+ */
+char *perf_name(int i);
+
+/**
+ * perf_read - Stores the counts since perf_open in @counts, scaled up if
+ * the kernel had to multiplex the PMU between groups.
+ */
+void perf_read(double *counts);
+
+/**
+ * perf_region - Returns the region called @name, created the first time.
+ * @name is kept, not copied.
+ */
+perf_region_t *perf_region(char *name);
+
+/**
+ * perf_begin - Starts counting for region @r.
+ */
+void perf_begin(perf_region_t *r);
+
+/**
+ * perf_end - Adds what was counted since perf_begin to region @r.
+ */
+void perf_end(perf_region_t *r);
+
+/**
+ * perf_report - Prints the totals of every region to @fp, with the
+ * counters used.
+ */
+void perf_report(FILE *fp);
+
+/******************************************************************************
+ * Command history.
+ *
+ * Command lines are appended to a file that several shells map MAP_SHARED
+ * and share. The file is never parsed, opening it costs an mmap whatever
+ * its size. It starts with a header holding the end of the records and,
+ * for the first 1, 2, 4, 8 and 16 bytes of a command, hash buckets holding
+ * the last record starting with them. Each record links to the previous
+ * one of each of its buckets, so a prefix search only visits the records
+ * of the bucket of its longest indexed prefix, and its next match is the
+ * next one of the same bucket. Each record also carries a 64-bit signature
+ * of its trigrams, and every 128 records an index record packs their
+ * signatures together: a substring search reads the indexes from the
+ * newest one and only compares the text of the entries whose signature
+ * matches.
+ *
+ * Appends are serialized with flock and published by storing the new end,
+ * so readers never take a lock. Entries are returned as pointers into the
+ * mapping, NUL-terminated and without their newline; passing one back as
+ * @from continues a search with the older entries.
+ ******************************************************************************/
+/**
+ * hist_open - Opens (creating it if needed) the history file @path, or
+ * $HISTFILE, or ~/.csapp_history if @path is NULL.
+ *
+ * @return 0 on success, -1 with errno set on error.
+ */
+int hist_open(char *path);
+
+/**
+ * hist_close - Unmaps and closes the history file.
+ */
+void hist_close(void);
+
+/**
+ * hist_add - Appends command line @cmd (up to its first newline) to the
+ * history, unless it is empty or repeats the last entry.
+ */
+void hist_add(char *cmd);
+
+/**
+ * hist_prev - Returns the entry before @from, the newest one if @from is
+ * NULL, or NULL if there are no more.
+ */
+char *hist_prev(char *from);
+
+/**
+ * hist_prefix - Returns the newest entry older than @from (all of them if
+ * NULL) that starts with @prefix, or NULL if none does.
+ */
+char *hist_prefix(char *prefix, char *from);
+
+/**
+ * hist_substr - Returns the newest entry older than @from (all of them if
+ * NULL) that contains @str, or NULL if none does.
+ */
+char *hist_substr(char *str, char *from);
+
+/**
+ * hist_expand - Replaces a history reference at the start of @line, a
+ * buffer of @maxlen bytes, with the entry it refers to:
+ *     !!          the last entry
+ *     !prefix     the last entry starting with prefix
+ *     !?string    the last entry containing string
+ * The rest of the line is kept after the entry.
+ *
+ * @return 1 if expanded, 0 if @line has no reference, -1 (after printing
+ * why) if no entry matches or the result does not fit.
+ */
+int hist_expand(char *line, int maxlen);
+
+/**
+ * builtin_history - history [-p prefix | -s string] [n]: prints the last
+ * n entries (16 by default) oldest first, or the last n starting with
+ * prefix or containing string, newest first.
+ */
+int builtin_history(char **argv);
+
+/******************************************************************************
+ * Wrappers for memory mapping functions.
+ ******************************************************************************/
+void *Mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset);
+void Munmap(void *start, size_t length);
+
+/******************************************************************************
+ * Shared memory.
+ *
+ * A region a parent maps before Fork and shares with its children: writes
+ * by any of them are seen by all, unlike the copies fork makes of the rest
+ * of memory (see signalprob0.c). Built on it:
+ *     counters updated with atomic instructions, which processes can
+ *     sleep on until they change;
+ *     a single-producer single-consumer ring of fixed-size messages;
+ *     futex_wait and futex_wake, to sleep on any int of the region.
+ * No lock is taken, and no system call is made unless a process has to
+ * sleep or to wake another one up.
+ ******************************************************************************/
+typedef struct shm shm_t;
+
+/**
+ * shm_create - Maps a shared region with room for @size bytes of objects.
+ */
+shm_t *shm_create(size_t size);
+
+/**
+ * shm_alloc - Carves @size zeroed bytes out of @shm, on cache lines of
+ * their own: @size is rounded up to a multiple of 64. Any process sharing
+ * @shm may allocate.
+ *
+ * @return the memory, or NULL if @shm is full.
+ */
+void *shm_alloc(shm_t *shm, size_t size);
+
+/**
+ * shm_destroy - Unmaps @shm, from the calling process only.
+ */
+void shm_destroy(shm_t *shm);
+
+/**
+ * futex_wait - Sleeps while *@uaddr == @val, at most @timeout
+ * milliseconds (-1 = forever).
+ *
+ * @return 0 if woken up or *@uaddr != @val, -1 on timeout.
+ */
+int futex_wait(int *uaddr, int val, int timeout);
+
+/**
+ * futex_wake - Wakes up at most @n processes sleeping on @uaddr.
+ */
+void futex_wake(int *uaddr, int n);
+
+/* A counter shared by processes, ready to use when zeroed */
+typedef struct {
+    long value;
+    int seq;            /* Futex word, bumped to wake up waiters */
+    int waiting;        /* Is somebody about to sleep in counter_wait? */
+} counter_t;
+
+/**
+ * counter_add - Atomically adds @n to @c and wakes up its waiters.
+ *
+ * @return the new value.
+ */
+long counter_add(counter_t *c, long n);
+
+/**
+ * counter_get - Returns the value of @c.
+ */
+long counter_get(counter_t *c);
+
+/**
+ * counter_wait - Sleeps while @c is @old, at most @timeout milliseconds
+ * (-1 = forever).
+ *
+ * @return the value of @c.
+ */
+long counter_wait(counter_t *c, long old, int timeout);
+
+/* Single-producer single-consumer ring */
+typedef struct spsc spsc_t;
+
+/**
+ * spsc_create - Allocates in @shm a ring of @n messages (a power of 2) of
+ * @size bytes each.
+ *
+ * @return the ring, or NULL if @shm is full.
+ */
+spsc_t *spsc_create(shm_t *shm, unsigned long n, size_t size);
+
+/**
+ * spsc_push - Copies message @msg into @q. Never blocks.
+ *
+ * @return 1 on success, 0 if @q is full.
+ */
+int spsc_push(spsc_t *q, const void *msg);
+
+/**
+ * spsc_pop - Copies the oldest message of @q into @msg and removes it.
+ * Never blocks.
+ *
+ * @return 1 on success, 0 if @q is empty.
+ */
+int spsc_pop(spsc_t *q, void *msg);
+
+/**
+ * spsc_push_wait, spsc_pop_wait - Like spsc_push and spsc_pop, but spin
+ * for a while, then sleep at most @timeout milliseconds (-1 = forever)
+ * while @q is full or empty.
+ *
+ * @return 1 on success, 0 on timeout.
+ */
+int spsc_push_wait(spsc_t *q, const void *msg, int timeout);
+int spsc_pop_wait(spsc_t *q, void *msg, int timeout);
+
+/******************************************************************************
+ * Process pool.
+ *
+ * A fixed set of preforked workers that run @fn(arg) for jobs submitted
+ * by the parent. Jobs and results travel through two lock-free rings in a
+ * MAP_SHARED region, so a job costs no fork, no exec and, while workers
+ * are busy, no system call at all. Idle workers sleep on a futex.
+ *
+ * The parent notices crashed workers while it waits for results, reports
+ * the job they were running as failed and forks a replacement.
+ ******************************************************************************/
+#define POOL_QSIZE (1024)           /* Max jobs in flight, a power of 2 */
+
+typedef long pool_fn_t(long arg);
+
+typedef struct {
+    long id;            /* Assigned by pool_submit */
+    long arg;           /* Input of the job */
+    long result;        /* Return value of fn(arg) */
+    int status;         /* 0, or the wait status of the worker that crashed */
+} pool_job_t;
+
+typedef struct pool pool_t;
+
+/**
+ * pool_create - Forks @nworkers workers that run @fn on submitted jobs.
+ */
+pool_t *pool_create(int nworkers, pool_fn_t *fn);
+
+/**
+ * pool_submit - Queues a job computing fn(@arg).
+ *
+ * @return the id of the job, or -1 if POOL_QSIZE jobs are already in
+ * flight (collect some with pool_result first).
+ */
+long pool_submit(pool_t *pool, long arg);
+
+/**
+ * pool_result - Waits for the next finished job, in completion order,
+ * and stores it in @job. job->status is non-zero if the worker running
+ * the job crashed, job->result is then meaningless.
+ *
+ * @return 1 if a job was stored, 0 if no job is in flight.
+ */
+int pool_result(pool_t *pool, pool_job_t *job);
+
+/**
+ * pool_destroy - Lets the workers finish the queued jobs, reaps them and
+ * frees the pool. Results not collected yet are lost.
+ */
+void pool_destroy(pool_t *pool);
 #endif
@@ -0,0 +1,81 @@
+#include "common.h"
+
+/**
+ * Runs M short jobs through a pool of N preforked workers, then the same
+ * jobs with one fork per job, and compares the throughput and the
+ * performance counters, workers and children included. Job number CRASH
+ * makes its worker abort, the pool reports it and respawns the worker.
+ */
+#define N (4)           /* Workers */
+#define M (100000)      /* Jobs */
+#define CRASH (4242)    /* This job crashes its worker */
+
+/* The job: sum of the first arg integers */
+long job(long arg)
+{
+    long i, sum = 0;
+
+    if (arg == CRASH)
+        abort();
+    for (i = 1; i <= arg % 1000; i++)
+        sum += i;
+    return sum;
+}
+
+/* collect - Accounts for one finished job */
+static void collect(pool_job_t *res, long *sum, long *failed)
+{
+    if (res->status) {
+        printf("job %ld failed: worker killed by signal %d\n",
+               res->id, WTERMSIG(res->status));
+        (*failed)++;
+    }
+    else
+        *sum += res->result;
+}
+
+int main(void)
+{
+    pool_t *pool;
+    pool_job_t res;
+    pid_t pid;
+    long i, sum, failed;
+    double start, end;
+
+    /* Through the pool */
+    PERF_BEGIN("pool");
+    start = clock_now();
+    pool = pool_create(N, job);
+    sum = failed = 0;
+    for (i = 0; i < M; ) {
+        /* Keep the pool full, collect results when it is */
+        if (pool_submit(pool, i) >= 0) {
+            i++;
+            continue;
+        }
+        pool_result(pool, &res);
+        collect(&res, &sum, &failed);
+    }
+    while (pool_result(pool, &res))
+        collect(&res, &sum, &failed);
+    pool_destroy(pool);
+    end = clock_now();
+    PERF_END("pool");
+    printf("pool:  %d jobs, %ld failed, sum=%ld, %.0f jobs/s\n",
+           M, failed, sum, M / (end - start));
+
+    /* One fork per job, the exit status carries the result */
+    PERF_BEGIN("fork");
+    start = clock_now();
+    for (i = 0; i < M / 10; i++) {
+        if ((pid = Fork()) == 0)
+            _exit(job(i) & 0xff);
+        Waitpid(pid, NULL, 0);
+    }
+    end = clock_now();
+    PERF_END("fork");
+    printf("fork:  %d jobs, %.0f jobs/s\n", M / 10, M / 10 / (end - start));
+    perf_report(stdout);
+
+    return 0;
+}
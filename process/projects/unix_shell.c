@@ -1,25 +1,85 @@
 #include "common.h"
 
 #define MAXLINE (8192)  /* Max length of command line string */
-#define MAXARGS (128)   /* Max length of argument list execve */
+#define MAXSTAGES (16)  /* Max number of commands in a pipeline */
+#define MAXJOBS (1024)  /* Max jobs at any point in time */
+#define PIDHASHSIZE (4096)  /* Buckets of the pid -> job table */
+
+/* Job states */
+#define UNDEF 0         /* undefined */
+#define FG 1            /* running in foreground */
+#define BG 2            /* running in background */
+#define ST 3            /* stopped */
+
+/*
+ * Job states: FG (foreground), BG (background), ST (stopped)
+ * Job state transitions and enabling actions:
+ *     FG -> ST  : ctrl-z
+ *     ST -> FG  : fg command
+ *     ST -> BG  : bg command
+ *     BG -> FG  : fg command
+ * At most 1 job can be in the FG state.
+ */
+typedef struct {
+    int jid;                    /* Job ID [1, 2, ...] */
+    int state;                  /* UNDEF, BG, FG, or ST */
+    pid_t pgid;                 /* Process group, led by the first stage */
+    int nprocs;                 /* Processes in the pipeline */
+    int nalive;                 /* Of which not terminated yet */
+    int nstopped;               /* Of which stopped */
+    pid_t pids[MAXSTAGES];      /* Process of every stage */
+    int statuses[MAXSTAGES];    /* Their wait statuses */
+    char *cmds[MAXSTAGES];      /* Their command names, for path_forget */
+    char *cmdline;              /* Command line, without the newline */
+    int timed;                  /* Print a time report when done? */
+    double start;               /* When the job was started */
+    struct rusage rusage;       /* Summed over its terminated processes */
+} job_t;
+
+/* Output of a batch job, collected by the shell */
+typedef struct output {
+    int seq;                    /* Line number of the command, from 1 */
+    int fd;                     /* Read end of the job's output pipe */
+    int eof;                    /* All output collected? */
+    char *buf;                  /* Output not printed yet */
+    size_t len, cap;
+    struct output *next;        /* Next output in command order */
+} output_t;
+
+/* A command of a pipeline */
+typedef struct {
+    char **argv;                /* Its words, inside the token list */
+    char *in;                   /* File of '<', or NULL */
+    char *out;                  /* File of '>', or NULL */
+} stage_t;
+
+/* An entry of the pid -> job hash table */
+typedef struct pident {
+    pid_t pid;
+    job_t *job;
+    int stage;                  /* Index of pid in job->pids */
+    struct pident *next;
+} pident_t;
 
 /**
- * parse_cmdline - parses the command line and build the argv list.
+ * parse_pipeline - Tokenizes the command line in place and splits it
+ * into stages at '|'. A stage is a command with optional '< file' and
+ * '> file' redirections, or only redirections (a splice stage).
  *
- * @buf - the command line.
- * @argv - the argv list to be built.
+ * @buf - the command line, modified.
+ * @stages - the stages to be built. Their argv lists live in the shell's
+ * token list and are valid until the next call.
+ * @bgp - set to true(1) if the line ends with '&'.
  *
- * @return true(1) if the job to be run is a background job, i.e
- * the last character in the @buf is ampersand &, otherwise
- * return false(0) indicating that the job is foreground job.
+ * @return the number of stages, 0 for an empty line, -1 on syntax error.
  */
-int parse_cmdline(char *buf, char *argv[]);
+int parse_pipeline(char *buf, stage_t stages[], int *bgp);
 
 /**
- * builtin_command - If the first argument is a builtin command,
- * run it and return true.
+ * builtin_command - If the command of stage @st is a builtin, runs it in
+ * the shell itself, with the stage's redirections, and returns true.
  */
-int builtin_command(char *argv[]);
+int builtin_command(stage_t *st);
 
 /**
  * eval - Evaluates command line.
@@ -29,121 +89,1092 @@ int builtin_command(char *argv[]);
 void eval(char *cmdline);
 
 /**
- * sigchld_handler - SIGCHLD signal handler.
+ * launch - Forks the processes of a pipeline and adds it to the job table.
+ * If @outfd is not -1, the job's stdout and stderr go to @outfd.
+ *
+ * @return the new job, or NULL if a command was not found.
  */
-void sigchld_handler(int signum);
+job_t *launch(stage_t stages[], int n, int bg, char *cmdline, int outfd);
+
+/**
+ * run_stage - Runs one stage of a pipeline in the forked child, with
+ * stdin and stdout already wired to the neighbouring pipes. Redirections
+ * take precedence over the pipes.
+ *
+ * A stage without a command is a splice stage:
+ *     < file      copies file into the pipeline
+ *     > file      last stage: copies the pipeline into file;
+ *                 other stages: also passes the data on, like tee(1)
+ *     < in > out  copies in to out
+ * Splice stages move data with splice/tee and never copy it through
+ * user space.
+ */
+void run_stage(stage_t *st, char *path, int last);
+
+/**
+ * Builtins that act on the shell itself, on top of the generic ones:
+ *     do_quit   quit
+ *     do_jobs   jobs
+ *     do_bgfg   bg and fg %jobid|pid
+ *     do_hash   hash [-r]
+ *     do_kill   kill, which also takes %jobid for the job's process group
+ *     do_wait   wait [%jobid|pid ...]: waits for the given background
+ *               jobs, or all of them, to terminate or stop
+ */
+int do_quit(char *argv[]);
+int do_jobs(char *argv[]);
+int do_bgfg(char *argv[]);
+int do_hash(char *argv[]);
+int do_kill(char *argv[]);
+int do_wait(char *argv[]);
+
+/**
+ * waitfg - Runs the event loop until @job is no longer the foreground
+ * job, i.e. until it has terminated or been stopped.
+ */
+void waitfg(job_t *job);
+
+/**
+ * sigchld_event - Reaps terminated children, with their rusage, and
+ * records stopped ones. Called from the event loop in normal context,
+ * never asynchronously.
+ */
+void sigchld_event(ev_loop_t *loop, const struct signalfd_siginfo *info,
+                   void *arg);
+
+/**
+ * sigint_event, sigtstp_event - Forward SIGINT and SIGTSTP to the
+ * process group of the foreground job, if any.
+ */
+void sigint_event(ev_loop_t *loop, const struct signalfd_siginfo *info,
+                  void *arg);
+void sigtstp_event(ev_loop_t *loop, const struct signalfd_siginfo *info,
+                   void *arg);
+
+/**
+ * stdin_event - Reads and evaluates the command lines available on stdin.
+ */
+void stdin_event(ev_loop_t *loop, int fd, unsigned int events, void *arg);
+
+/**
+ * batch_event - Batch mode (-j N) counterpart of stdin_event: starts every
+ * command line as a background job, as long as fewer than N are running.
+ */
+void batch_event(ev_loop_t *loop, int fd, unsigned int events, void *arg);
+
+/**
+ * output_event - Collects the output of a batch job.
+ */
+void output_event(ev_loop_t *loop, int fd, unsigned int events, void *arg);
+
+
+/* Job table helpers */
+job_t *addjob(pid_t pgid, int state, char *cmdline);
+void addproc(job_t *job, pid_t pid, char *cmd);
+void finishjob(job_t *job);
+void deletejob(job_t *job);
+job_t *getjobjid(int jid);
+job_t *getjobpid(pid_t pid, int *stagep);
+void listjobs(void);
+
+
+static ev_loop_t loop;      /* Multiplexes stdin and signals */
+static rio_t rio;           /* Buffered stdin */
+static int interactive;     /* Does the shell own the terminal? */
+static int script;          /* Script mode: no prompts, no job messages */
+static int acct_on;         /* Log every job's resource usage (-a)? */
+static int hist_on;         /* Are command lines added to the history? */
+static tokens_t toks;       /* Tokens of the command line being evaluated */
 
+static job_t *jobs[MAXJOBS + 1];    /* Indexed by job id, jobs[0] unused */
+static int maxjid;                  /* Largest job id in use */
+static int njobs;                   /* Jobs in the table */
+static job_t *fgjob;                /* The foreground job, or NULL */
+static pident_t *pidtab[PIDHASHSIZE];   /* pid -> job hash table */
 
-int main()
+static int maxpar;          /* Batch mode: max jobs in flight, 0 = off */
+static int keep_order;      /* Batch mode: print outputs in command order */
+static int batch_seq;       /* Batch mode: command lines started */
+static int batch_eof;       /* Batch mode: end of stdin reached */
+static int nout;            /* Batch mode: outputs not fully printed yet */
+static output_t *out_head;  /* Batch mode, -k: the same outputs, in order */
+static output_t *out_tail;
+
+static int wait_intr;       /* SIGINT arrived during the wait builtin */
+static int subshell;        /* Running a builtin in a job's own process */
+
+/* Builtins, sorted by name for builtin_find */
+static builtin_t builtins[] = {
+    {"[", builtin_test},
+    {"bg", do_bgfg},
+    {"cd", builtin_cd},
+    {"echo", builtin_echo},
+    {"export", builtin_export},
+    {"false", builtin_false},
+    {"fg", do_bgfg},
+    {"hash", do_hash},
+    {"history", builtin_history},
+    {"jobs", do_jobs},
+    {"kill", do_kill},
+    {"printf", builtin_printf},
+    {"pwd", builtin_pwd},
+    {"quit", do_quit},
+    {"test", builtin_test},
+    {"true", builtin_true},
+    {"wait", do_wait}
+};
+#define NBUILTINS (sizeof(builtins) / sizeof(builtins[0]))
+
+/**
+ * usage - Prints the command line options and exits.
+ */
+static void usage(char *prog)
 {
-    char cmdline[MAXLINE];
-    
-    /* Install SIGCHLD signal handler */
-    Signal(SIGCHLD, sigchld_handler);
+    printf("usage: %s [-s] [-j N [-k]] [-a file] [-H file]\n", prog);
+    printf("   -s     script mode: no prompts, no job messages. The default\n");
+    printf("          when stdin is not a terminal\n");
+    printf("   -j N   batch mode: run the command lines of stdin in parallel,\n");
+    printf("          at most N at a time (N = 0: one per CPU)\n");
+    printf("   -k     batch mode: print outputs in command order instead of\n");
+    printf("          tagging each output line with its command's number\n");
+    printf("   -a file  append a line of resource usage for every job to file\n");
+    printf("   -H file  history file, used in script mode too. Interactive\n");
+    printf("          shells default to $HISTFILE or ~/.csapp_history\n");
+    exit(1);
+}
 
-    while (1) {
-        printf("unix_shell> ");
-        fflush(stdout);
+int main(int argc, char **argv)
+{
+    sigset_t mask;
+    char *histfile = NULL;
+    int c;
 
-        /* Read user input */
-        Fgets(cmdline, MAXLINE, stdin);
+    while ((c = getopt(argc, argv, "sj:ka:H:")) != -1) {
+        switch (c) {
+            case 's':
+                script = 1;
+                break;
+            case 'j':
+                if ((maxpar = atoi(optarg)) <= 0)
+                    maxpar = sysconf(_SC_NPROCESSORS_ONLN);
+                break;
+            case 'k':
+                keep_order = 1;
+                break;
+            case 'a':
+                acct_open(optarg);
+                acct_on = 1;
+                break;
+            case 'H':
+                histfile = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (keep_order && !maxpar)
+        usage(argv[0]);
+    if (maxpar || !isatty(STDIN_FILENO))
+        script = 1;
 
-        if (feof(stdin))    exit(0);
+    ev_init(&loop);
+    tok_init(&toks);
 
-        /* Evaluate user's input */
-        eval(cmdline);
+    /* SIGCHLD, SIGINT and SIGTSTP are blocked and read back through a signalfd */
+    ev_add_signal(&loop, SIGCHLD, sigchld_event, NULL);
+    ev_add_signal(&loop, SIGINT, sigint_event, NULL);
+    ev_add_signal(&loop, SIGTSTP, sigtstp_event, NULL);
+
+    Rio_readinitb(&rio, STDIN_FILENO);
+    if (maxpar) {
+        ev_add_fd(&loop, STDIN_FILENO, EV_READ, batch_event, NULL);
+        ev_run(&loop);
+        return 0;
+    }
+
+    /* Hand the terminal to foreground jobs if we are in charge of it */
+    if (isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == Getpgrp()) {
+        interactive = 1;
+        Sigemptyset(&mask);
+        Sigaddset(&mask, SIGTTOU);      /* for tcsetpgrp from the background */
+        Sigaddset(&mask, SIGTTIN);
+        Sigprocmask(SIG_BLOCK, &mask, NULL);
+    }
+
+    /* A shell without its history still works */
+    if (histfile != NULL || !script) {
+        if (hist_open(histfile) < 0)
+            fprintf(stderr, "history: %s\n", strerror(errno));
+        else
+            hist_on = 1;
     }
+
+    ev_add_fd(&loop, STDIN_FILENO, EV_READ, stdin_event, NULL);
+
+    if (!script) {
+        printf("unix_shell> ");
+        fflush(stdout);
+    }
+
+    ev_run(&loop);
     return 0;
 }
 
-/* parse_cmdline */
-int parse_cmdline(char *buf, char *argv[])
+/**
+ * stage_empty - Does stage @st have neither words nor redirections?
+ */
+static int stage_empty(stage_t *st)
+{
+    return st->argv[0] == NULL && st->in == NULL && st->out == NULL;
+}
+
+/**
+ * stage_name - Returns the name of stage @st in job messages.
+ */
+static char *stage_name(stage_t *st)
+{
+    if (st->argv[0] != NULL)
+        return st->argv[0];
+    return st->in != NULL ? "<" : ">";
+}
+
+/**
+ * strip_time - Removes the time keyword in front of the pipeline whose
+ * first stage is @st, if any.
+ *
+ * @return true(1) if the pipeline is to be timed.
+ */
+static int strip_time(stage_t *st)
+{
+    if (st->argv[0] == NULL || strcmp(st->argv[0], "time"))
+        return 0;
+    st->argv++;
+    return 1;
+}
+
+int parse_pipeline(char *buf, stage_t stages[], int *bgp)
 {
-    int bg;         /* background job? */
-    int argc;       /* number of arguments in arguments list argv */
-    char *delim;    /* first space in buf */
+    int i, k, n;
+    char **argv;
 
-    /* replace the last newline with space */
-    buf[strlen(buf)-1] = ' ';
+    if (tokenize(buf, &toks) < 0) {
+        printf("Syntax error: unterminated quote.\n");
+        return -1;
+    }
 
-    /* skip leading spaces */
-    while (*buf && (*buf == ' '))   buf++;
+    /*
+     * Words are compacted in place within the token list, which leaves
+     * room for the NULL ending each stage where its '|' was.
+     */
+    argv = toks.argv;
+    n = k = 0;
+    *bgp = 0;
+    stages[0].argv = argv;
+    stages[0].in = stages[0].out = NULL;
+    for (i = 0; i < toks.n; i++) {
+        switch (toks.types[i]) {
+            case TOK_WORD:
+                argv[k++] = argv[i];
+                break;
+            case TOK_IN:
+            case TOK_OUT:
+                if (i + 1 == toks.n || toks.types[i + 1] != TOK_WORD) {
+                    printf("Syntax error near '%s'.\n", argv[i]);
+                    return -1;
+                }
+                if (toks.types[i] == TOK_IN)
+                    stages[n].in = argv[i + 1];
+                else
+                    stages[n].out = argv[i + 1];
+                i++;
+                break;
+            case TOK_PIPE:
+                argv[k++] = NULL;
+                if (stage_empty(&stages[n])) {
+                    printf("Syntax error near '|'.\n");
+                    return -1;
+                }
+                if (++n == MAXSTAGES) {
+                    printf("Too many commands in pipeline.\n");
+                    return -1;
+                }
+                stages[n].argv = argv + k;
+                stages[n].in = stages[n].out = NULL;
+                break;
+            case TOK_BG:
+                if (i + 1 != toks.n) {
+                    printf("Syntax error near '&'.\n");
+                    return -1;
+                }
+                *bgp = 1;
+                break;
+        }
+    }
+    argv[k] = NULL;
 
-    argc = 0;
-    while ((delim = strchr(buf, ' ')) != NULL) {
-        argv[argc++] = buf;
-        *delim = '\0';
-        buf = delim + 1;
+    if (stage_empty(&stages[n])) {
+        if (n == 0)
+            return 0;
+        printf("Syntax error near '|'.\n");
+        return -1;
+    }
+    return n + 1;
+}
 
-        /* skip until first non-whitespace character */
-        while (*buf && (*buf == ' '))   buf++;
-    }        
-   
-    /* append NULL to argv */
-    argv[argc] = NULL;
+int builtin_command(stage_t *st)
+{
+    builtin_t *b;
 
-    if (argc == 0)  return 1;
-    
-    if ((bg = (*argv[argc - 1] == '&')) != 0) argv[--argc] = NULL;
-    return bg;
+    if (st->argv[0] == NULL ||
+        (b = builtin_find(builtins, NBUILTINS, st->argv[0])) == NULL)
+        return 0;
+    builtin_run(b->fn, st->argv, st->in, st->out);
+    return 1;
 }
 
-int builtin_command(char *argv[])
+int do_quit(char *argv[])
 {
-    if (!strcmp(argv[0], "quit"))   exit(0);
-    if (!strcmp(argv[0], "&"))      return 1;
+    exit(0);
+}
+
+int do_jobs(char *argv[])
+{
+    listjobs();
+    return 0;
+}
+
+int do_hash(char *argv[])
+{
+    if (argv[1] != NULL && !strcmp(argv[1], "-r"))
+        path_clear();
+    else
+        path_print();
     return 0;
 }
 
 void eval(char *cmdline)
 {
-    char *argv[MAXARGS];
+    stage_t stages[MAXSTAGES];
     char buf[MAXLINE];
-    int bg;
-    pid_t pid;
+    char *line = cmdline, *name;
+    int bg, n, timed;
+    double start;
+    struct rusage ru, ru_start;
+    job_t *job;
 
-    sigset_t mask, prev;
+    /*
+     * Interactively the intact command line is kept for job messages, and
+     * for the accounting log. Otherwise the line is tokenized in place
+     * and the job is known by its first command's name.
+     */
+    if (!script || acct_on)
+        line = strcpy(buf, cmdline);
+    if ((n = parse_pipeline(line, stages, &bg)) <= 0)
+        return;
+    if ((timed = strip_time(&stages[0])) && stage_empty(&stages[0])) {
+        printf("usage: time command\n");
+        return;
+    }
 
-    Sigemptyset(&mask);
-    Sigaddset(&mask, SIGCHLD);
+    /* A builtin costs the shell itself */
+    if (timed) {
+        start = clock_now();
+        getrusage(RUSAGE_SELF, &ru_start);
+    }
+    if (n == 1 && builtin_command(&stages[0])) {
+        if (timed) {
+            getrusage(RUSAGE_SELF, &ru);
+            rusage_sub(&ru, &ru_start);
+            fflush(stdout);
+            rusage_print(stderr, clock_now() - start, &ru);
+        }
+        return;
+    }
+
+    name = line == buf ? cmdline : stage_name(&stages[0]);
+    if ((job = launch(stages, n, bg, name, -1)) == NULL)
+        return;
+    job->timed = timed;
+
+    /* Parent waits for foreground job to terminate */
+    if (!bg)
+        waitfg(job);
+    else if (!script)
+        printf("[%d] (%d) %s\n", job->jid, job->pgid, job->cmdline);
+    return;
+}
+
+job_t *launch(stage_t stages[], int n, int bg, char *cmdline, int outfd)
+{
+    char *paths[MAXSTAGES];
+    int i, in, fds[2];
+    pid_t pid, pgid;
+    job_t *job;
 
-    strcpy(buf, cmdline);
-    bg = parse_cmdline(buf, argv);
-    if (argv[0] == NULL) return; 
-    if (!builtin_command(argv)) {
+    /* Resolve every command through the PATH cache before forking any */
+    for (i = 0; i < n; i++) {
+        paths[i] = NULL;
+        if (stages[i].argv[0] == NULL ||
+            builtin_find(builtins, NBUILTINS, stages[i].argv[0]) != NULL)
+            continue;
+        if ((paths[i] = path_lookup(stages[i].argv[0])) == NULL) {
+            printf("%s: Command not found.\n", stages[i].argv[0]);
+            return NULL;
+        }
+    }
+
+    if (njobs == MAXJOBS) {
+        printf("Tried to create too many jobs\n");
+        return NULL;
+    }
+
+    /* Children must not inherit unflushed output */
+    fflush(stdout);
+
+    /* Fork the stages left to right, each reading the previous one's pipe */
+    in = STDIN_FILENO;
+    pgid = 0;
+    job = NULL;
+    for (i = 0; i < n; i++) {
+        if (i < n - 1)
+            Pipe(fds);
 
-        /* Child run user's job */
         if ((pid = Fork()) == 0) {
-            if (execve(argv[0], argv, environ) < 0) {
-                printf("%s: Command not found.\n", argv[0]);
-                exit(0);
+            /* The whole pipeline is one process group, led by stage 0 */
+            Setpgid(0, pgid);
+            if (interactive && !bg)
+                tcsetpgrp(STDIN_FILENO, pgid ? pgid : getpid());
+            ev_child_reset(&loop);
+
+            if (in != STDIN_FILENO) {
+                Dup2(in, STDIN_FILENO);
+                Close(in);
+            }
+            if (outfd >= 0) {
+                Dup2(outfd, STDOUT_FILENO);
+                Dup2(outfd, STDERR_FILENO);
             }
+            if (i < n - 1) {
+                Close(fds[0]);
+                Dup2(fds[1], STDOUT_FILENO);
+                Close(fds[1]);
+            }
+            run_stage(&stages[i], paths[i], i == n - 1);
         }
 
-        /* Parent waits for foreground job to terminate */
-        if (!bg) {
-            /* temporarily block SIGCHLD */
-            Sigprocmask(SIG_BLOCK, &mask, &prev); 
-            Waitpid(pid, NULL, 0);
-            /* Unblock SIGCHLD */
-            Sigprocmask(SIG_SETMASK, &prev, NULL);
+        /* Also set it here, whichever of parent and child runs first */
+        if (pgid == 0) {
+            pgid = pid;
+            job = addjob(pgid, bg ? BG : FG, cmdline);
         }
-        else {
-            printf("%d %s", pid, cmdline);
+        setpgid(pid, pgid);
+        addproc(job, pid, stages[i].argv[0]);
+
+        if (in != STDIN_FILENO)
+            Close(in);
+        if (i < n - 1) {
+            Close(fds[1]);
+            in = fds[0];
         }
     }
-    return;
+    return job;
+}
+
+/**
+ * parse_job - Returns the job @id, %jobid or pid, refers to, or NULL after
+ * printing an error on behalf of builtin @cmd.
+ */
+static job_t *parse_job(char *cmd, char *id)
+{
+    job_t *job;
+
+    if (id[0] == '%') {
+        if ((job = getjobjid(atoi(id + 1))) == NULL)
+            printf("%s: No such job\n", id);
+    }
+    else if (id[0] >= '0' && id[0] <= '9') {
+        if ((job = getjobpid(atoi(id), NULL)) == NULL)
+            printf("(%s): No such process\n", id);
+    }
+    else {
+        printf("%s: argument must be a PID or %%jobid\n", cmd);
+        job = NULL;
+    }
+    return job;
+}
+
+int do_bgfg(char *argv[])
+{
+    job_t *job;
+
+    if (subshell) {
+        printf("%s: no job control\n", argv[0]);
+        return 1;
+    }
+    if (argv[1] == NULL) {
+        printf("%s command requires PID or %%jobid argument\n", argv[0]);
+        return 1;
+    }
+    if ((job = parse_job(argv[0], argv[1])) == NULL)
+        return 1;
+
+    /* Restart the whole pipeline */
+    Kill(-job->pgid, SIGCONT);
+    job->nstopped = 0;
+
+    if (!strcmp(argv[0], "bg")) {
+        job->state = BG;
+        printf("[%d] (%d) %s\n", job->jid, job->pgid, job->cmdline);
+    }
+    else {
+        job->state = FG;
+        waitfg(job);
+    }
+    return 0;
 }
 
-void sigchld_handler(int signum)
+int do_kill(char *argv[])
 {
-    int olderrno = errno;
-    
-    while (waitpid(-1, NULL, 0) > 0) {
-        sio_puts("reaped a child.");
+    int signum, status = 0;
+    char *queue;
+    pid_t pid;
+    job_t *job;
+
+    if ((argv = kill_signal(argv, &signum, &queue)) == NULL)
+        return 1;
+    for (; *argv != NULL; argv++) {
+        if ((*argv)[0] == '%') {
+            if ((job = parse_job("kill", *argv)) == NULL) {
+                status = 1;
+                continue;
+            }
+            pid = -job->pgid;
+        }
+        else
+            pid = atoi(*argv);
+        if (kill_send(pid, signum, queue) < 0) {
+            printf("kill: (%s): %s\n", *argv, strerror(errno));
+            status = 1;
+        }
     }
+    return status;
+}
 
-    if (errno != ECHILD)    unix_error("Waitpid error^_^");
-    errno = olderrno;
+/**
+ * bg_running - Is some background job still running?
+ */
+static int bg_running(void)
+{
+    int jid;
+
+    for (jid = 1; jid <= maxjid; jid++)
+        if (jobs[jid] != NULL && jobs[jid]->state == BG)
+            return 1;
+    return 0;
 }
 
+int do_wait(char *argv[])
+{
+    job_t *job;
+    int i, jid;
+
+    /* The shell's jobs are not children of a job's process */
+    if (subshell)
+        return 0;
+
+    /*
+     * Like waitfg, without handing over the terminal. Only SIGINT breaks
+     * the wait, since no foreground job would take it.
+     */
+    wait_intr = 0;
+    ev_del_fd(&loop, STDIN_FILENO);
+    if (argv[1] == NULL) {
+        while (!wait_intr && bg_running())
+            ev_run_once(&loop, -1);
+    }
+    for (i = 1; argv[i] != NULL && !wait_intr; i++) {
+        if ((job = parse_job(argv[0], argv[i])) == NULL)
+            continue;
+        jid = job->jid;
+        while (!wait_intr && getjobjid(jid) == job && job->state == BG)
+            ev_run_once(&loop, -1);
+    }
+    ev_add_fd(&loop, STDIN_FILENO, EV_READ, stdin_event, NULL);
+    return wait_intr ? 130 : 0;
+}
+
+/**
+ * open_redirect - Opens @file for a redirection in a forked child, which
+ * exits if that fails.
+ */
+static int open_redirect(char *file, int flags)
+{
+    int fd;
+
+    if ((fd = open(file, flags, 0666)) < 0) {
+        printf("%s: %s\n", file, strerror(errno));
+        exit(1);
+    }
+    return fd;
+}
+
+void run_stage(stage_t *st, char *path, int last)
+{
+    int in, out;
+
+    in = STDIN_FILENO;
+    out = STDOUT_FILENO;
+    if (st->in != NULL)
+        in = open_redirect(st->in, O_RDONLY);
+    if (st->out != NULL)
+        out = open_redirect(st->out, O_WRONLY | O_CREAT | O_TRUNC);
+
+    if (st->argv[0] == NULL) {
+        if (out == STDOUT_FILENO || last || in != STDIN_FILENO)
+            splice_copy(in, out);
+        else
+            tee_copy(in, STDOUT_FILENO, out);
+        exit(0);
+    }
+
+    if (in != STDIN_FILENO) {
+        Dup2(in, STDIN_FILENO);
+        Close(in);
+    }
+    if (out != STDOUT_FILENO) {
+        Dup2(out, STDOUT_FILENO);
+        Close(out);
+    }
+    if (path == NULL) {     /* A builtin, no need to exec anything */
+        subshell = 1;
+        exit(builtin_find(builtins, NBUILTINS, st->argv[0])->fn(st->argv));
+    }
+    if (execve(path, st->argv, environ) < 0) {
+        printf("%s: Command not found.\n", st->argv[0]);
+        exit(127);
+    }
+}
+
+void waitfg(job_t *job)
+{
+    /*
+     * SIGCHLD stays blocked the whole time, so the job cannot be reaped
+     * before fgjob is set. Stdin belongs to the job meanwhile.
+     */
+    fgjob = job;
+    ev_del_fd(&loop, STDIN_FILENO);
+    if (interactive)
+        tcsetpgrp(STDIN_FILENO, job->pgid);
+
+    while (fgjob != NULL)
+        ev_run_once(&loop, -1);
+
+    if (interactive)
+        tcsetpgrp(STDIN_FILENO, Getpgrp());
+    if (!maxpar)
+        ev_add_fd(&loop, STDIN_FILENO, EV_READ, stdin_event, NULL);
+    else if (!batch_eof)
+        ev_add_fd(&loop, STDIN_FILENO, EV_READ, batch_event, NULL);
+}
+
+void sigchld_event(ev_loop_t *loop, const struct signalfd_siginfo *info,
+                   void *arg)
+{
+    pid_t pid;
+    int stage, status;
+    struct rusage ru;
+    job_t *job;
+
+    /* Pending SIGCHLDs coalesce, so reap everything that is ready */
+    while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED, &ru)) > 0) {
+        if ((job = getjobpid(pid, &stage)) == NULL)
+            continue;
+
+        if (WIFSTOPPED(status)) {
+            /* The job is stopped once all of its live processes are */
+            if (++job->nstopped == job->nalive && job->state != ST) {
+                printf("Job [%d] (%d) stopped by signal %d\n",
+                       job->jid, job->pgid, WSTOPSIG(status));
+                job->state = ST;
+                if (job == fgjob)
+                    fgjob = NULL;
+            }
+            continue;
+        }
+
+        job->statuses[stage] = status;
+        rusage_add(&job->rusage, &ru);
+        job->nalive--;
+        if (WIFSIGNALED(status) && stage == job->nprocs - 1)
+            printf("Job [%d] (%d) terminated by signal %d\n",
+                   job->jid, job->pgid, WTERMSIG(status));
+        if (job->nalive > 0)
+            continue;
+
+        /* The whole job is done */
+        finishjob(job);
+        if (job == fgjob)
+            fgjob = NULL;
+        else if (job->state == BG && !script)
+            printf("[%d] (%d) Done %s\n", job->jid, job->pgid, job->cmdline);
+        deletejob(job);
+
+        /* Batch mode: a slot is free, start the next command line */
+        if (maxpar && !batch_eof && njobs == maxpar - 1)
+            ev_add_fd(loop, STDIN_FILENO, EV_READ, batch_event, NULL);
+    }
+
+    if (maxpar && batch_eof && njobs == 0 && nout == 0)
+        exit(0);
+
+    if (pid < 0 && errno != ECHILD)
+        unix_error("wait4 error");
+}
+
+void sigint_event(ev_loop_t *loop, const struct signalfd_siginfo *info,
+                  void *arg)
+{
+    if (fgjob != NULL)
+        Kill(-fgjob->pgid, SIGINT);
+    else
+        wait_intr = 1;
+}
+
+void sigtstp_event(ev_loop_t *loop, const struct signalfd_siginfo *info,
+                   void *arg)
+{
+    if (fgjob != NULL)
+        Kill(-fgjob->pgid, SIGTSTP);
+}
+
+void stdin_event(ev_loop_t *loop, int fd, unsigned int events, void *arg)
+{
+    char cmdline[MAXLINE];
+    int rc;
+
+    /* Evaluate every line already sitting in the rio buffer */
+    do {
+        if (Rio_readlineb(&rio, cmdline, MAXLINE) == 0)
+            exit(0);    /* EOF */
+
+        /* Record the line as it runs, after !-references are expanded */
+        if (hist_on) {
+            if ((rc = hist_expand(cmdline, MAXLINE)) < 0)
+                continue;
+            if (rc > 0 && !script)
+                printf("%s", cmdline);
+            hist_add(cmdline);
+        }
+        eval(cmdline);
+    } while (rio.rio_cnt > 0);
+
+    if (!script) {
+        printf("unix_shell> ");
+        fflush(stdout);
+    }
+}
+
+
+/*****************************************************************************
+ * Job table helpers. Jobs are found by job id through the jobs array and by
+ * pid through the pidtab hash table, neither needs a scan of the table.
+ *****************************************************************************/
+
+/* addjob - Adds a job with no processes yet to the job table */
+job_t *addjob(pid_t pgid, int state, char *cmdline)
+{
+    job_t *job;
+    int jid;
+
+    /* Like bash, the new job gets the largest job id in use plus one */
+    if ((jid = maxjid + 1) > MAXJOBS) {
+        for (jid = 1; jobs[jid] != NULL; jid++)
+            ;
+    }
+    else
+        maxjid = jid;
+
+    job = Malloc(sizeof(job_t));
+    job->jid = jid;
+    job->state = state;
+    job->pgid = pgid;
+    job->nprocs = job->nalive = job->nstopped = 0;
+    job->cmdline = strdup(cmdline);
+    job->cmdline[strcspn(job->cmdline, "\n")] = '\0';
+    job->timed = 0;
+    job->start = clock_now();
+    memset(&job->rusage, 0, sizeof(job->rusage));
+    jobs[jid] = job;
+    njobs++;
+    return job;
+}
+
+/* addproc - Records process @pid, running @cmd, as the next stage of @job */
+void addproc(job_t *job, pid_t pid, char *cmd)
+{
+    pident_t *p = Malloc(sizeof(pident_t));
+    int i = job->nprocs++;
+
+    job->pids[i] = pid;
+    job->statuses[i] = 0;
+    job->cmds[i] = cmd ? strdup(cmd) : NULL;
+    job->nalive++;
+
+    p->pid = pid;
+    p->job = job;
+    p->stage = i;
+    p->next = pidtab[pid % PIDHASHSIZE];
+    pidtab[pid % PIDHASHSIZE] = p;
+}
+
+/**
+ * finishjob - Accounts for @job, whose processes have all terminated:
+ * prints its time report if timed, logs it, and forgets the cached paths
+ * of commands that could not be executed (exit status 127).
+ */
+void finishjob(job_t *job)
+{
+    double real = clock_now() - job->start;
+    int i;
+
+    if (job->timed)
+        rusage_print(stderr, real, &job->rusage);
+    acct_log(job->cmdline, job->statuses[job->nprocs - 1], real, &job->rusage);
+
+    for (i = 0; i < job->nprocs; i++)
+        if (job->cmds[i] != NULL && WIFEXITED(job->statuses[i]) &&
+            WEXITSTATUS(job->statuses[i]) == 127)
+            path_forget(job->cmds[i]);
+}
+
+/* deletejob - Removes @job and its processes from the job table */
+void deletejob(job_t *job)
+{
+    pident_t **pp, *p;
+    int i;
+
+    for (i = 0; i < job->nprocs; i++) {
+        for (pp = &pidtab[job->pids[i] % PIDHASHSIZE]; (p = *pp) != NULL;
+             pp = &p->next) {
+            if (p->pid == job->pids[i]) {
+                *pp = p->next;
+                Free(p);
+                break;
+            }
+        }
+        Free(job->cmds[i]);
+    }
+
+    jobs[job->jid] = NULL;
+    njobs--;
+    while (maxjid > 0 && jobs[maxjid] == NULL)
+        maxjid--;
+    Free(job->cmdline);
+    Free(job);
+}
+
+/* getjobjid - Finds a job by job id */
+job_t *getjobjid(int jid)
+{
+    if (jid < 1 || jid > MAXJOBS)
+        return NULL;
+    return jobs[jid];
+}
+
+/* getjobpid - Finds the job of process @pid, and its stage if @stagep */
+job_t *getjobpid(pid_t pid, int *stagep)
+{
+    pident_t *p;
+
+    for (p = pidtab[pid % PIDHASHSIZE]; p != NULL; p = p->next) {
+        if (p->pid == pid) {
+            if (stagep != NULL)
+                *stagep = p->stage;
+            return p->job;
+        }
+    }
+    return NULL;
+}
+
+/* listjobs - Prints the job table */
+void listjobs(void)
+{
+    job_t *job;
+    int jid;
+
+    for (jid = 1; jid <= maxjid; jid++) {
+        if ((job = jobs[jid]) == NULL)
+            continue;
+        printf("[%d] (%d) ", job->jid, job->pgid);
+        switch (job->state) {
+            case BG:
+                printf("Running ");
+                break;
+            case FG:
+                printf("Foreground ");
+                break;
+            case ST:
+                printf("Stopped ");
+                break;
+            default:
+                printf("listjobs: Internal error: job[%d].state=%d ",
+                       jid, job->state);
+        }
+        printf("%s\n", job->cmdline);
+    }
+}
+
+
+/*****************************************************************************
+ * Batch mode. Every command line of stdin is a background job whose stdout
+ * and stderr go to a pipe read by the shell. The shell stops reading stdin
+ * while maxpar jobs are running, so starting the next job only waits for
+ * the first of them to exit. Outputs are either printed line by line,
+ * each line tagged with its command's number, or (-k) printed whole in
+ * command order.
+ *****************************************************************************/
+
+/**
+ * batch_start - Starts @cmdline as batch job number @seq.
+ */
+static void batch_start(char *cmdline, int seq)
+{
+    stage_t stages[MAXSTAGES];
+    char buf[MAXLINE], *line = cmdline, *name;
+    int bg, n, timed, fds[2];
+    output_t *out;
+    job_t *job;
+
+    /*
+     * Tokenized in place, like in script mode, unless the accounting log
+     * needs the line. Builtins run in the job's own process too, so that
+     * their output is collected like any other.
+     */
+    if (acct_on)
+        line = strcpy(buf, cmdline);
+    if ((n = parse_pipeline(line, stages, &bg)) <= 0)
+        return;
+    if ((timed = strip_time(&stages[0])) && stage_empty(&stages[0]))
+        return;
+
+    /* Close-on-exec, so that other jobs do not keep the pipe open */
+    if (pipe2(fds, O_CLOEXEC) < 0)
+        unix_error("pipe2 error");
+    name = acct_on ? cmdline : stage_name(&stages[0]);
+    if ((job = launch(stages, n, 1, name, fds[1])) == NULL) {
+        Close(fds[0]);
+        Close(fds[1]);
+        return;
+    }
+    job->timed = timed;
+    Close(fds[1]);
+
+    out = Calloc(1, sizeof(output_t));
+    out->seq = seq;
+    out->fd = fds[0];
+    nout++;
+    if (keep_order) {
+        if (out_tail != NULL)
+            out_tail->next = out;
+        else
+            out_head = out;
+        out_tail = out;
+    }
+    ev_add_fd(&loop, out->fd, EV_READ, output_event, out);
+}
+
+/**
+ * batch_print - Prints what can be printed of @out's output: complete
+ * lines tagged with the command's number, or everything at once in -k
+ * mode.
+ */
+static void batch_print(output_t *out)
+{
+    char *line, *nl;
+
+    if (keep_order) {
+        fwrite(out->buf, 1, out->len, stdout);
+        out->len = 0;
+        return;
+    }
+
+    line = out->buf;
+    while ((nl = memchr(line, '\n', out->buf + out->len - line)) != NULL) {
+        printf("[%d] %.*s\n", out->seq, (int)(nl - line), line);
+        line = nl + 1;
+    }
+    if (out->eof && line < out->buf + out->len) {
+        printf("[%d] %.*s\n", out->seq, (int)(out->buf + out->len - line), line);
+        line = out->buf + out->len;
+    }
+    out->len -= line - out->buf;
+    memmove(out->buf, line, out->len);
+}
+
+void output_event(ev_loop_t *loop, int fd, unsigned int events, void *arg)
+{
+    output_t *out = arg;
+    ssize_t n;
+
+    if (out->cap - out->len < RIO_BUFSIZE) {
+        out->cap = 2 * out->cap + RIO_BUFSIZE;
+        out->buf = Realloc(out->buf, out->cap);
+    }
+    if ((n = read(fd, out->buf + out->len, out->cap - out->len)) < 0) {
+        if (errno == EINTR || errno == EAGAIN)
+            return;
+        unix_error("output_event error");
+    }
+    out->len += n;
+    if (n == 0) {
+        out->eof = 1;
+        ev_del_fd(loop, fd);
+        Close(fd);
+    }
+
+    if (!keep_order) {
+        batch_print(out);
+        if (out->eof) {
+            Free(out->buf);
+            Free(out);
+            nout--;
+        }
+    }
+    else {
+        /* Print every finished output at the head, in command order */
+        while (out_head != NULL && out_head->eof) {
+            out = out_head;
+            batch_print(out);
+            if ((out_head = out->next) == NULL)
+                out_tail = NULL;
+            Free(out->buf);
+            Free(out);
+            nout--;
+        }
+    }
+    fflush(stdout);
+
+    if (batch_eof && njobs == 0 && nout == 0)
+        exit(0);
+}
+
+void batch_event(ev_loop_t *loop, int fd, unsigned int events, void *arg)
+{
+    char cmdline[MAXLINE];
+
+    /* Start jobs while there is a free slot and input in the rio buffer */
+    do {
+        if (Rio_readlineb(&rio, cmdline, MAXLINE) == 0) {
+            batch_eof = 1;
+            ev_del_fd(loop, STDIN_FILENO);
+            if (njobs == 0 && nout == 0)
+                exit(0);
+            return;
+        }
+        batch_start(cmdline, ++batch_seq);
+    } while (njobs < maxpar && rio.rio_cnt > 0);
+
+    /* All slots taken, sigchld_event resumes reading when one frees up */
+    if (njobs >= maxpar)
+        ev_del_fd(loop, STDIN_FILENO);
+}
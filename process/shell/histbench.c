@@ -0,0 +1,108 @@
+#include "common.h"
+
+/**
+ * histbench - Fills a fresh history file with N generated command lines,
+ * then measures what the shells pay for it:
+ *
+ *   add         hist_add, per command line (flock, append, publish)
+ *   open        hist_open of the full file, which is never parsed
+ *   prefix      hist_prefix of a 2-byte, a 1-byte and a longer prefix,
+ *               for the newest match and for the 100th newest
+ *   substr      hist_substr, hit near the end and a miss, which scans
+ *               every entry
+ *
+ * and the performance counters of each kind of operation.
+ *
+ * usage: histbench [-n N] [file]   (default: 1000000 lines, ./histbench.hist)
+ */
+#define ROUNDS (100)
+
+/* Command lines the history is made of, %d is the line number */
+static char *templates[] = {
+    "gcc -O2 -Wall -c src/module%d.c -o build/module%d.o",
+    "grep -n \"pattern %d\" logs/app.log | sort | uniq -c > out/count%d.txt",
+    "git commit -m 'change %d' && git push origin topic%d",
+    "cp data/input%d.csv /tmp/work/input%d.csv",
+    "make -j8 target%d TEST=%d",
+    "ls -la /var/log/app%d/run%d",
+};
+#define NTEMPLATES (sizeof(templates) / sizeof(templates[0]))
+
+/**
+ * bench - Prints how long @find takes for @key, up to the @depth-th newest
+ * match, averaged over ROUNDS, and the match.
+ */
+static void bench(char *name, char *(*find)(char *, char *), char *key,
+                  int depth)
+{
+    char *e = NULL;
+    double start, t;
+    int r, i;
+
+    PERF_BEGIN(name);
+    start = clock_now();
+    for (r = 0; r < ROUNDS; r++)
+        for (e = NULL, i = 0; i < depth; i++)
+            if ((e = find(key, e)) == NULL)
+                break;
+    t = (clock_now() - start) / ROUNDS;
+    PERF_END(name);
+    printf("%-7s %-14s %5d %12.3f us  %s\n", name, key, depth, t * 1e6,
+           e ? e : "(none)");
+}
+
+int main(int argc, char **argv)
+{
+    char *file = "histbench.hist", line[256];
+    long i, n = 1000000;
+    double start;
+    struct stat st;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:")) != -1) {
+        if (c != 'n') {
+            fprintf(stderr, "usage: %s [-n N] [file]\n", argv[0]);
+            exit(1);
+        }
+        n = atol(optarg);
+    }
+    if (optind < argc)
+        file = argv[optind];
+
+    unlink(file);
+    if (hist_open(file) < 0)
+        unix_error("hist_open error");
+    PERF_BEGIN("add");
+    start = clock_now();
+    for (i = 0; i < n; i++) {
+        sprintf(line, templates[i % NTEMPLATES], (int)i, (int)i);
+        hist_add(line);
+    }
+    printf("add     %ld lines %12.3f us/line\n", n,
+           (clock_now() - start) * 1e6 / n);
+    PERF_END("add");
+    hist_close();
+
+    PERF_BEGIN("open");
+    start = clock_now();
+    if (hist_open(file) < 0)
+        unix_error("hist_open error");
+    PERF_END("open");
+    stat(file, &st);
+    printf("open    %.1f MB   %12.3f us\n", st.st_size / 1e6,
+           (clock_now() - start) * 1e6);
+
+    bench("prefix", hist_prefix, "gi", 1);
+    bench("prefix", hist_prefix, "gi", 100);
+    bench("prefix", hist_prefix, "g", 1);
+    bench("prefix", hist_prefix, "g", 100);
+    bench("prefix", hist_prefix, "make -j8 target1", 1);
+    bench("substr", hist_substr, "topic", 1);
+    bench("substr", hist_substr, "module1234", 1);
+    bench("substr", hist_substr, "no such text", 1);
+
+    hist_close();
+    unlink(file);
+    perf_report(stdout);
+    return 0;
+}
@@ -1,7 +1,7 @@
 #include "common.h"
 
-#define MAXARGS (128)    /* max length of argument list execve */
 #define MAXLINE (8192)   /* max text line length */
+#define SCRIPT_BUFSIZE (1 << 16)    /* stdin buffer in script mode */
 
 /**
  * Evaluates command line.
@@ -14,108 +14,356 @@
 void eval(char *cmdline);
 
 /**
- * parseline - Parse the command line and build the argv array
+ * parseline - Parse the command line in place and build the argv array.
+ * The files of '<' and '>' redirections are taken out of the words and
+ * returned in *inp and *outp, NULL if absent.
+ *
+ * @return 1 for a background job, 0 for a foreground job, -1 on error.
  */
-int parseline(char *buf, char **argv);
+int parseline(char *buf, char ***argvp, char **inp, char **outp);
 
 /**
  * builtin_command - If the first argument is a builtin command,
- * run it and return true.
+ * run it, with stdin from @in and stdout to @out unless NULL, and
+ * return true.
+ */
+int builtin_command(char **argv, char *in, char *out);
+
+/* Builtins of this shell, besides the generic ones of common.c */
+int do_quit(char **argv);       /* quit */
+int do_hash(char **argv);       /* hash [-r] */
+int do_wait(char **argv);       /* wait [pid ...], all children by default */
+
+/* A command, until it is reaped */
+typedef struct proc {
+    pid_t pid;
+    int timed;              /* Print a time report when done? */
+    double start;           /* When it was started */
+    char *cmd;              /* Its command line */
+    struct proc *next;      /* Next background process */
+} proc_t;
+
+/**
+ * reaped - Accounts for process @pid, which terminated with @status
+ * and used @ru: prints its time report if timed and logs it.
  */
-int builtin_command(char **argv);
+void reaped(pid_t pid, int status, struct rusage *ru);
+
+static int script;   /* Script mode: no prompts, no job messages */
+static int acct_on;  /* Log every job's resource usage (-a)? */
+static int hist_on;  /* Are command lines added to the history? */
+static tokens_t toks;   /* Tokens of the command line, argv lives here */
+static proc_t *bgprocs; /* Background processes not reaped yet */
+static proc_t fgproc;   /* The foreground process */
+
+/* Builtins, sorted by name for builtin_find */
+static builtin_t builtins[] = {
+    {"[", builtin_test},
+    {"cd", builtin_cd},
+    {"echo", builtin_echo},
+    {"export", builtin_export},
+    {"false", builtin_false},
+    {"hash", do_hash},
+    {"history", builtin_history},
+    {"kill", builtin_kill},
+    {"printf", builtin_printf},
+    {"pwd", builtin_pwd},
+    {"quit", do_quit},
+    {"test", builtin_test},
+    {"true", builtin_true},
+    {"wait", do_wait}
+};
+#define NBUILTINS (sizeof(builtins) / sizeof(builtins[0]))
 
 /**
- * main
+ * main - usage: shell [-s] [-a file] [-H file]. Script mode (-s) is the
+ * default when stdin is not a terminal. -a appends a line of resource
+ * usage for every command to file. Interactive command lines go to the
+ * history file $HISTFILE or ~/.csapp_history, or to the -H file in any
+ * mode.
  */
-int main(void)
+int main(int argc, char **argv)
 {
     char cmdline[MAXLINE];
-    
+    char *histfile = NULL;
+    int c;
+
+    while ((c = getopt(argc, argv, "sa:H:")) != -1) {
+        if (c == 's')
+            script = 1;
+        else if (c == 'a') {
+            acct_open(optarg);
+            acct_on = 1;
+        }
+        else if (c == 'H')
+            histfile = optarg;
+        else {
+            printf("usage: %s [-s] [-a file] [-H file]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    /* Scripts get no prompts and are read in large chunks */
+    script = script || !isatty(STDIN_FILENO);
+    if (script)
+        setvbuf(stdin, NULL, _IOFBF, SCRIPT_BUFSIZE);
+    tok_init(&toks);
+
+    /* A shell without its history still works */
+    if (histfile != NULL || !script) {
+        if (hist_open(histfile) < 0)
+            fprintf(stderr, "history: %s\n", strerror(errno));
+        else
+            hist_on = 1;
+    }
+
     while (1) { 
         
-        printf("> "); 
+        if (!script)
+            printf("> "); 
         Fgets(cmdline, MAXLINE, stdin);
 
         if (feof(stdin))
             exit(0);
 
+        /* Record the line as it runs, after !-references are expanded */
+        if (hist_on) {
+            if ((c = hist_expand(cmdline, MAXLINE)) < 0)
+                continue;
+            if (c > 0 && !script)
+                printf("%s", cmdline);
+            hist_add(cmdline);
+        }
+
         /* Eveluate */
         eval(cmdline);
     }
     return 0;
 }
 
+/**
+ * redirect - Opens @file and makes it descriptor @target, in the forked
+ * child, which exits if that fails.
+ */
+static void redirect(char *file, int flags, int target)
+{
+    int fd;
+
+    if ((fd = open(file, flags, 0666)) < 0) {
+        printf("%s: %s\n", file, strerror(errno));
+        exit(1);
+    }
+    Dup2(fd, target);
+    Close(fd);
+}
+
 void eval(char *cmdline)
 {
-    char *argv[MAXARGS]; /* Argument list execve() */
+    char **argv;         /* Argument list execve() */
+    char *in, *out;      /* Redirections */
     char buf[MAXLINE];   /* Holds modified command line */
+    char *line;          /* The line parseline modifies */
     int bg;              /* Should the job run in background or foreground? */
     pid_t pid;           /* Process id */
+    char *path;          /* Executable argv[0] resolves to */
+    int timed;           /* Preceded by time? */
+    int status;          /* Wait status */
+    struct rusage ru, ru_start;
+    proc_t *p;
 
-    strcpy(buf, cmdline);
-    bg = parseline(buf, argv);
+    /* Account for the background processes done meanwhile */
+    while ((pid = wait4(-1, &status, WNOHANG, &ru)) > 0)
+        reaped(pid, status, &ru);
 
+    /* Only interactive mode and the log need cmdline, scripts parse in place */
+    line = script && !acct_on ? cmdline : strcpy(buf, cmdline);
+    if ((bg = parseline(line, &argv, &in, &out)) < 0)
+        return;
+
+    if ((timed = argv[0] != NULL && !strcmp(argv[0], "time")))
+        argv++;
     if (argv[0] == NULL) {
+        if (timed)
+            printf("usage: time command\n");
         return; 
     }
 
-    if (!builtin_command(argv)) {
-        /* Child run user job */
+    /* A builtin costs the shell itself */
+    if (timed) {
+        fgproc.start = clock_now();
+        getrusage(RUSAGE_SELF, &ru_start);
+    }
+    if (builtin_command(argv, in, out)) {
+        if (timed) {
+            getrusage(RUSAGE_SELF, &ru);
+            rusage_sub(&ru, &ru_start);
+            fflush(stdout);
+            rusage_print(stderr, clock_now() - fgproc.start, &ru);
+        }
+    }
+    else {
+        /* Look the command up in PATH, through the hash cache */
+        if ((path = path_lookup(argv[0])) == NULL) {
+            printf("%s: Command not found.\n", argv[0]);
+            return;
+        }
+
+        /* Child run user job, without a copy of our unflushed output */
+        fflush(stdout);
         if ((pid = Fork()) == 0) {
-            if (execve(argv[0], argv, environ) < 0) {
+            if (in != NULL)
+                redirect(in, O_RDONLY, STDIN_FILENO);
+            if (out != NULL)
+                redirect(out, O_WRONLY | O_CREAT | O_TRUNC, STDOUT_FILENO);
+            if (execve(path, argv, environ) < 0) {
                 printf("%s: Command not found.\n", argv[0]);
-                exit(0);
+                exit(127);
             }
         }
 
+        p = bg ? Malloc(sizeof(proc_t)) : &fgproc;
+        p->pid = pid;
+        p->timed = timed;
+        p->start = clock_now();
+        p->cmd = line == buf ? cmdline : argv[0];
+
         /* Parent waits for foreground job to terminate */
         if (!bg) {
-            int status;
-            if (waitpid(pid, &status, 0) < 0) {
-                unix_error("waitfg: waitpid error");
+            if (wait4(pid, &status, 0, &ru) < 0) {
+                unix_error("waitfg: wait4 error");
             }
+            reaped(pid, status, &ru);
+            fgproc.pid = 0;
+
+            /* Exec failed: the cached path is stale */
+            if (WIFEXITED(status) && WEXITSTATUS(status) == 127)
+                path_forget(argv[0]);
+        }
+        else {
+            p->cmd = strdup(p->cmd);
+            p->next = bgprocs;
+            bgprocs = p;
+            if (!script)
+                printf("%d %s", pid, cmdline);
         }
-        else
-            printf("%d %s", pid, cmdline);
     }
     return;
 }
 
-int builtin_command(char **argv)
+void reaped(pid_t pid, int status, struct rusage *ru)
+{
+    proc_t **pp, *p = &fgproc;
+    double real;
+
+    if (pid != fgproc.pid) {
+        for (pp = &bgprocs; (p = *pp) != NULL && p->pid != pid; pp = &p->next)
+            ;
+        if (p == NULL)
+            return;
+        *pp = p->next;
+    }
+
+    real = clock_now() - p->start;
+    if (p->timed)
+        rusage_print(stderr, real, ru);
+    acct_log(p->cmd, status, real, ru);
+
+    if (p != &fgproc) {
+        Free(p->cmd);
+        Free(p);
+    }
+}
+
+int builtin_command(char **argv, char *in, char *out)
 {
-    if (!strcmp(argv[0], "quit"))
-        exit(0);
-    if (!strcmp(argv[0], "&"))
-        return 1;
+    builtin_t *b;
+
+    if ((b = builtin_find(builtins, NBUILTINS, argv[0])) == NULL)
+        return 0;
+    builtin_run(b->fn, argv, in, out);
+    return 1;
+}
+
+int do_quit(char **argv)
+{
+    exit(0);
+}
+
+int do_hash(char **argv)
+{
+    if (argv[1] != NULL && !strcmp(argv[1], "-r"))
+        path_clear();
+    else
+        path_print();
     return 0;
 }
 
-int parseline(char *buf, char **argv)
+int do_wait(char **argv)
 {
-    char *delim;                    /* Points to the first space delimiter */
+    struct rusage ru;
+    pid_t pid;
+    int i, status;
+
+    if (argv[1] == NULL) {
+        while ((pid = wait4(-1, &status, 0, &ru)) > 0)
+            reaped(pid, status, &ru);
+        return 0;
+    }
+    for (i = 1; argv[i] != NULL; i++) {
+        if ((pid = wait4(atoi(argv[i]), &status, 0, &ru)) < 0) {
+            printf("wait: (%s): %s\n", argv[i], strerror(errno));
+            return 1;
+        }
+        reaped(pid, status, &ru);
+    }
+    return 0;
+}
+
+int parseline(char *buf, char ***argvp, char **inp, char **outp)
+{
+    char **argv;                    /* Words, compacted in toks */
     int argc;                       /* Number of arguments */
-    int bg;                         /* Background job? */
+    int i;
 
-    buf[strlen(buf) - 1] = ' ';     /* Replace trailing '\n' with space */
-    while (*buf && (*buf == ' '))   /* Ignore leading spaces */
-        buf++;
+    if (tokenize(buf, &toks) < 0) {
+        printf("Syntax error: unterminated quote.\n");
+        return -1;
+    }
 
-    /* Build the argv list */
+    /* Build the argv list, without the redirections */
+    argv = *argvp = toks.argv;
+    *inp = *outp = NULL;
     argc = 0;
-    while ((delim = strchr(buf, ' '))) {
-        argv[argc++] = buf;
-        *delim = '\0';
-        buf = delim + 1;
-        while (*buf && (*buf == ' '))
-            buf++;
+    for (i = 0; i < toks.n; i++) {
+        switch (toks.types[i]) {
+            case TOK_WORD:
+                argv[argc++] = argv[i];
+                break;
+            case TOK_IN:
+            case TOK_OUT:
+                if (i + 1 == toks.n || toks.types[i + 1] != TOK_WORD) {
+                    printf("Syntax error near '%s'.\n", argv[i]);
+                    return -1;
+                }
+                if (toks.types[i] == TOK_IN)
+                    *inp = argv[i + 1];
+                else
+                    *outp = argv[i + 1];
+                i++;
+                break;
+            case TOK_PIPE:
+                printf("Pipelines are not supported.\n");
+                return -1;
+            case TOK_BG:
+                if (i + 1 != toks.n) {
+                    printf("Syntax error near '&'.\n");
+                    return -1;
+                }
+                break;
+        }
     }
     argv[argc] = NULL;
 
-    if (argc == 0)
-        return 1;
-
     /* Should the job run in the background */
-    if ((bg = (*argv[argc-1] == '&')) != 0)
-        argv[--argc] = NULL;
-    return bg;
+    return toks.n > 0 && toks.types[toks.n - 1] == TOK_BG;
 }
@@ -0,0 +1,175 @@
+#include "common.h"
+
+/**
+ * tokbench - Measures how fast a script is split into words by
+ *
+ *   parseline   the original parser: copies each line, then splits it at
+ *               spaces with strchr into a fixed argv (MAXARGS words).
+ *   tokenize    the single-pass tokenizer of common.c: splits in place,
+ *               handles quotes, escapes and operators.
+ *
+ * The script is the file given on the command line, or a generated one of
+ * N lines mixing plain commands, quoted arguments, pipelines and
+ * redirections. Each parser runs over the whole script ROUNDS times; the
+ * script is restored between rounds, outside the timed region, which is
+ * also a region of the performance counters.
+ *
+ * usage: tokbench [-n N] [file]     (default: 1000000 generated lines)
+ */
+#define MAXARGS (128)
+#define MAXLINE (8192)
+#define ROUNDS (5)
+
+/* parseline - The original parser of shell.c, kept as the baseline */
+static int parseline(char *buf, char **argv)
+{
+    char *delim;
+    int argc;
+
+    buf[strlen(buf) - 1] = ' ';
+    while (*buf && (*buf == ' '))
+        buf++;
+
+    argc = 0;
+    while ((delim = strchr(buf, ' '))) {
+        argv[argc++] = buf;
+        *delim = '\0';
+        buf = delim + 1;
+        while (*buf && (*buf == ' '))
+            buf++;
+    }
+    argv[argc] = NULL;
+    return argc;
+}
+
+/* Lines the generated script is made of, %d is the line number */
+static char *templates[] = {
+    "gcc -O2 -Wall -c src/module%d.c -o build/module%d.o\n",
+    "grep -n \"pattern %d\" logs/app.log | sort | uniq -c > out/count%d.txt\n",
+    "echo 'processing item %d' \"of batch %d\"\n",
+    "cp data/input%d.csv /tmp/work/input\\ %d.csv\n",
+    "./worker --id %d --retries 3 --timeout 30 < jobs/%d.json &\n",
+    "tar czf backup/archive%d.tgz   etc/conf%d   var/lib/state\n",
+};
+#define NTEMPLATES (sizeof(templates) / sizeof(templates[0]))
+
+/**
+ * generate - Returns a script of @n lines, each followed by a NUL, and
+ * stores its size in @sizep.
+ */
+static char *generate(long n, size_t *sizep)
+{
+    size_t size = 0, cap = n * 80;
+    char *script = Malloc(cap);
+    long i;
+
+    for (i = 0; i < n; i++) {
+        if (cap - size < MAXLINE)
+            script = Realloc(script, cap *= 2);
+        size += sprintf(script + size, templates[i % NTEMPLATES], (int)i,
+                        (int)i) + 1;
+    }
+    *sizep = size;
+    return script;
+}
+
+/**
+ * load - Returns the script in @file with a NUL after each line, and
+ * stores its size in @sizep and its number of lines in @np.
+ */
+static char *load(char *file, size_t *sizep, long *np)
+{
+    char line[MAXLINE];
+    size_t size = 0, cap = 1 << 20, len;
+    char *script = Malloc(cap);
+    FILE *fp;
+
+    if ((fp = fopen(file, "r")) == NULL)
+        unix_error(file);
+    *np = 0;
+    while (fgets(line, MAXLINE, fp) != NULL) {
+        len = strlen(line) + 1;
+        if (cap - size < len)
+            script = Realloc(script, cap *= 2);
+        memcpy(script + size, line, len);
+        size += len;
+        (*np)++;
+    }
+    fclose(fp);
+    *sizep = size;
+    return script;
+}
+
+int main(int argc, char **argv)
+{
+    char *script, *work, **lines;
+    char *args[MAXARGS + 1], buf[MAXLINE];
+    tokens_t toks;
+    size_t size;
+    long i, n = 1000000, words;
+    double start, t_old, t_new;
+    int c, r;
+
+    while ((c = getopt(argc, argv, "n:")) != -1) {
+        if (c != 'n') {
+            fprintf(stderr, "usage: %s [-n N] [file]\n", argv[0]);
+            exit(1);
+        }
+        n = atol(optarg);
+    }
+    if (optind < argc)
+        script = load(argv[optind], &size, &n);
+    else
+        script = generate(n, &size);
+    tok_init(&toks);
+
+    /* Line boundaries are known up front, like rio_readlineb's return */
+    work = Malloc(size);
+    lines = Malloc(n * sizeof(char *));
+    lines[0] = work;
+    for (i = 1; i < n; i++)
+        lines[i] = lines[i - 1] + strlen(script + (lines[i - 1] - work)) + 1;
+
+    printf("%ld lines, %.1f MB, %d rounds\n", n, size / 1e6, ROUNDS);
+
+    /* Baseline: copy, then split at spaces */
+    t_old = 0;
+    words = 0;
+    for (r = 0; r < ROUNDS; r++) {
+        memcpy(work, script, size);
+        PERF_BEGIN("parseline");
+        start = clock_now();
+        for (i = 0; i < n; i++)
+            words += parseline(strcpy(buf, lines[i]), args);
+        t_old += clock_now() - start;
+        PERF_END("parseline");
+    }
+    printf("parseline %8.1f ns/line %8.1f MB/s %10ld words/round\n",
+           t_old * 1e9 / (n * ROUNDS), size * ROUNDS / t_old / 1e6,
+           words / ROUNDS);
+
+    /* Single pass, in place */
+    t_new = 0;
+    words = 0;
+    for (r = 0; r < ROUNDS; r++) {
+        memcpy(work, script, size);
+        PERF_BEGIN("tokenize");
+        start = clock_now();
+        for (i = 0; i < n; i++)
+            if (tokenize(lines[i], &toks) > 0)
+                words += toks.n;
+        t_new += clock_now() - start;
+        PERF_END("tokenize");
+    }
+    printf("tokenize  %8.1f ns/line %8.1f MB/s %10ld tokens/round\n",
+           t_new * 1e9 / (n * ROUNDS), size * ROUNDS / t_new / 1e6,
+           words / ROUNDS);
+    printf("speedup   %8.2fx\n", t_old / t_new);
+    perf_report(stdout);
+
+    tok_free(&toks);
+    Free(lines);
+    Free(work);
+    Free(script);
+    return 0;
+}
@@ -0,0 +1,53 @@
+#include "common.h"
+
+#define N (4)           /* Children */
+#define M (1000000)     /* Increments per child */
+#define REPORT (0.1)    /* Seconds between progress lines */
+
+/*
+ * signalprob0.c, where a child's writes to a global are lost for its
+ * parent, now with the counter in shared memory. N children add 1 to it
+ * M times each, concurrently, while the parent sleeps on it and reports
+ * its progress every REPORT seconds. No increment is lost, no signal is
+ * sent.
+ */
+
+long plain;     /* Each child increments its own copy */
+
+int main()
+{
+    shm_t *shm;
+    counter_t *counter;
+    long value = 0;
+    double last = 0.0;
+    int i, j;
+
+    /* Shared memory is set up before the fork */
+    shm = shm_create(sizeof(counter_t));
+    counter = shm_alloc(shm, sizeof(counter_t));
+
+    for (i = 0; i < N; i++) {
+        if (Fork() == 0) {
+            for (j = 0; j < M; j++) {
+                counter_add(counter, 1);
+                plain++;
+            }
+            exit(0);
+        }
+    }
+
+    while (value < N * M) {
+        value = counter_wait(counter, value, 10);
+        if (clock_now() - last >= REPORT) {
+            printf("counter = %ld\n", value);
+            last = clock_now();
+        }
+    }
+    while (waitpid(-1, NULL, 0) > 0)
+        ;
+
+    printf("shared counter: %ld, plain global: %ld (expected %d)\n",
+           counter_get(counter), plain, N * M);
+    shm_destroy(shm);
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include "common.h"
+
+/**
+ * ringbench - Sends N messages of S bytes from a parent to its child and
+ * measures the throughput of
+ *
+ *   pipe        one write and one read per message
+ *   spsc        spsc_push_wait / spsc_pop_wait on a ring in shared
+ *               memory, no system call unless a side has to sleep
+ *
+ * The child checks that every message carries its sequence number, and
+ * reports back with a shared counter, which the parent sleeps on. The
+ * performance counters of both processes are reported for each run.
+ *
+ * usage: ringbench [N [S]]     (default: 10000000 messages of 64 bytes)
+ */
+#define RING (1024)             /* Messages in the ring */
+#define MAXMSG (4096)
+
+/* check - Exits unless message @msg of the child is number @i */
+static void check(char *msg, long i)
+{
+    if (*(long *)msg != i) {
+        fprintf(stderr, "message %ld: got %ld\n", i, *(long *)msg);
+        exit(1);
+    }
+}
+
+static void report(char *name, long n, size_t size, double t)
+{
+    printf("%-6s %10.0f msgs/s %10.1f MB/s %8.1f ns/msg\n", name, n / t,
+           n * size / t / 1e6, t * 1e9 / n);
+}
+
+static void run_pipe(long n, size_t size)
+{
+    char msg[MAXMSG] = {0};
+    double start;
+    int fds[2];
+    long i;
+
+    if (pipe(fds) < 0)
+        unix_error("pipe error");
+    fflush(stdout);             /* Or the child prints it again */
+    PERF_BEGIN("pipe");
+    start = clock_now();
+    if (Fork() == 0) {
+        Close(fds[1]);
+        for (i = 0; i < n; i++) {
+            if (rio_readn(fds[0], msg, size) != size)
+                app_error("pipe: short read");
+            check(msg, i);
+        }
+        exit(0);
+    }
+    Close(fds[0]);
+    for (i = 0; i < n; i++) {
+        *(long *)msg = i;
+        Rio_writen(fds[1], msg, size);
+    }
+    Close(fds[1]);
+    Wait(NULL);
+    report("pipe", n, size, clock_now() - start);
+    PERF_END("pipe");
+}
+
+static void run_spsc(long n, size_t size)
+{
+    char msg[MAXMSG] = {0};
+    counter_t *done;
+    spsc_t *q;
+    shm_t *shm;
+    double start;
+    long i;
+
+    /* The messages, plus a page for the counter and the ring's indexes */
+    shm = shm_create(RING * size + 4096);
+    done = shm_alloc(shm, sizeof(counter_t));
+    if ((q = spsc_create(shm, RING, size)) == NULL)
+        app_error("spsc_create: region too small for the ring");
+
+    fflush(stdout);             /* Or the child prints it again */
+    PERF_BEGIN("spsc");
+    start = clock_now();
+    if (Fork() == 0) {
+        for (i = 0; i < n; i++) {
+            spsc_pop_wait(q, msg, -1);
+            check(msg, i);
+        }
+        counter_add(done, 1);
+        exit(0);
+    }
+    for (i = 0; i < n; i++) {
+        *(long *)msg = i;
+        spsc_push_wait(q, msg, -1);
+    }
+    counter_wait(done, 0, -1);
+    report("spsc", n, size, clock_now() - start);
+    Wait(NULL);
+    PERF_END("spsc");
+    shm_destroy(shm);
+}
+
+int main(int argc, char **argv)
+{
+    long n = argc > 1 ? atol(argv[1]) : 10000000;
+    size_t size = argc > 2 ? atol(argv[2]) : 64;
+
+    if (size < sizeof(long) || size > MAXMSG) {
+        fprintf(stderr, "usage: %s [N [S]], %d >= S >= %d\n", argv[0],
+                MAXMSG, (int)sizeof(long));
+        exit(1);
+    }
+    printf("%ld messages of %d bytes\n", n, (int)size);
+    run_pipe(n, size);
+    run_spsc(n, size);
+    perf_report(stdout);
+    return 0;
+}
@@ -0,0 +1,328 @@
+#include "common.h"
+#include <sched.h>
+
+/**
+ * sigbench - Measures signal round trips between two processes: the
+ * parent sends a signal to its child, which answers with a signal, N
+ * times in a row. Each way, the signal is received with
+ *
+ *   handler      a handler installed with Signal does all the work: the
+ *                child's answers, the parent's times the trip and sends
+ *                the next signal. main only sleeps in sigsuspend.
+ *   sigsuspend   the signal is blocked, main waits in Sigsuspend for the
+ *                handler to set a flag, then acts in normal context.
+ *   sigwaitinfo  the signal is blocked and has no handler, main takes it
+ *                with sigwaitinfo.
+ *   signalfd     the signal is blocked and read from a signalfd.
+ *   epoll        same, through the event loop of common.c (epoll_wait,
+ *                then the read), as the shells and supervisors do.
+ *   rt queued    SIGRTMIN sent with sigqueue, carrying the trip number,
+ *                taken with sigwaitinfo; every payload is checked.
+ *
+ * For each it reports the median, 99th percentile and max round trip time
+ * and the number of signals delivered per second, then the performance
+ * counters of both processes for each. -1 pins both processes to the same
+ * CPU, otherwise the scheduler places them.
+ *
+ * usage: sigbench [-1] [N]     (default: 100000 round trips)
+ */
+#define WARMUP (1000)           /* Round trips not timed */
+#define SIG SIGUSR1
+
+static double *rtt;             /* Round trip times, in seconds */
+static int total;               /* Round trips, WARMUP included */
+static pid_t peer;              /* The other process */
+static sigset_t mask;           /* Just the signal of the method */
+static sigset_t waitmask;       /* Signal mask while in sigsuspend */
+static volatile sig_atomic_t got;   /* Signal seen by the handler */
+static int sfd;                 /* signalfd */
+static ev_loop_t loop;          /* epoll */
+static int seq;                 /* rt queued: payload expected next */
+
+/* A way to receive signals, the same on both sides */
+typedef struct {
+    char *name;
+    int signum;
+    void (*init)(void);         /* After the fork, in both processes */
+    void (*wait)(void);         /* Waits for the peer's signal */
+    void (*send)(int n);        /* Sends signal number @n to the peer */
+    void (*fini)(void);
+} method_t;
+
+
+/* Strategy: all in the handlers */
+static volatile sig_atomic_t ntrips;
+static double sent_at;
+
+void ping_handler(int signum)
+{
+    double t = clock_now();
+
+    if (ntrips >= WARMUP)
+        rtt[ntrips - WARMUP] = t - sent_at;
+    if (++ntrips < total) {
+        sent_at = clock_now();
+        kill(peer, SIG);
+    }
+}
+
+void pong_handler(int signum)
+{
+    kill(peer, SIG);
+}
+
+/* run_handler - Plays the whole game from the handlers */
+static void run_handler(void)
+{
+    sigset_t prev;
+    pid_t pid;
+
+    ntrips = 0;
+    Signal(SIG, pong_handler);
+    Sigprocmask(SIG_BLOCK, &mask, &prev);
+    if ((pid = Fork()) == 0) {
+        peer = getppid();
+        Sigprocmask(SIG_SETMASK, &prev, NULL);
+        while (1)
+            pause();
+    }
+    peer = pid;
+    Signal(SIG, ping_handler);
+    PERF_BEGIN("handler");
+    sent_at = clock_now();
+    Kill(peer, SIG);
+    while (ntrips < total)
+        Sigsuspend(&prev);
+    Sigprocmask(SIG_SETMASK, &prev, NULL);
+    Kill(pid, SIGKILL);
+    Waitpid(pid, NULL, 0);
+    PERF_END("handler");
+    Signal(SIG, SIG_DFL);
+}
+
+
+/* Strategy: sigsuspend */
+void flag_handler(int signum)
+{
+    got = 1;
+}
+
+static void init_sigsuspend(void)
+{
+    Signal(SIG, flag_handler);
+}
+
+static void wait_sigsuspend(void)
+{
+    while (!got)
+        Sigsuspend(&waitmask);
+    got = 0;
+}
+
+static void fini_sigsuspend(void)
+{
+    Signal(SIG, SIG_DFL);
+}
+
+
+/* Strategy: sigwaitinfo */
+static void wait_sigwaitinfo(void)
+{
+    Sigwaitinfo(&mask, NULL);
+}
+
+
+/* Strategy: signalfd */
+static void init_signalfd(void)
+{
+    if ((sfd = signalfd(-1, &mask, SFD_CLOEXEC)) < 0)
+        unix_error("signalfd error");
+}
+
+static void wait_signalfd(void)
+{
+    struct signalfd_siginfo info;
+
+    Read(sfd, &info, sizeof(info));
+}
+
+static void fini_signalfd(void)
+{
+    Close(sfd);
+}
+
+
+/* Strategy: event loop */
+void sig_event(ev_loop_t *loop, const struct signalfd_siginfo *info,
+               void *arg)
+{
+    got = 1;
+}
+
+static void init_epoll(void)
+{
+    ev_init(&loop);
+    ev_add_signal(&loop, SIG, sig_event, NULL);
+}
+
+static void wait_epoll(void)
+{
+    while (!got)
+        ev_run_once(&loop, -1);
+    got = 0;
+}
+
+static void fini_epoll(void)
+{
+    ev_close(&loop);
+}
+
+
+/* Strategy: queued real-time signals */
+static void init_rt(void)
+{
+    seq = 0;
+}
+
+static void wait_rt(void)
+{
+    siginfo_t info;
+
+    Sigwaitinfo(&mask, &info);
+    if (info.si_value.sival_int != seq) {
+        fprintf(stderr, "rt queued: got payload %d, expected %d\n",
+                info.si_value.sival_int, seq);
+        exit(1);
+    }
+    seq++;
+}
+
+static void send_rt(int n)
+{
+    union sigval value;
+
+    value.sival_int = n;
+    Sigqueue(peer, Sigrt(0), value);
+}
+
+
+static void send_kill(int n)
+{
+    Kill(peer, SIG);
+}
+
+static void nop(void)
+{
+}
+
+/* run - Plays ping-pong with a child, both using method @m */
+static void run(method_t *m)
+{
+    sigset_t prev;
+    pid_t pid;
+    double t;
+    int i;
+
+    /* Blocked before the fork: no signal can come before init */
+    Sigprocmask(SIG_BLOCK, &mask, &prev);
+    waitmask = prev;
+    Sigdelset(&waitmask, m->signum);
+    got = 0;
+
+    if ((pid = Fork()) == 0) {
+        peer = getppid();
+        m->init();
+        for (i = 0; ; i++) {
+            m->wait();
+            m->send(i);
+        }
+    }
+    peer = pid;
+    m->init();
+    PERF_BEGIN(m->name);
+    for (i = 0; i < total; i++) {
+        t = clock_now();
+        m->send(i);
+        m->wait();
+        if (i >= WARMUP)
+            rtt[i - WARMUP] = clock_now() - t;
+    }
+    m->fini();
+    Kill(pid, SIGKILL);
+    Waitpid(pid, NULL, 0);
+    PERF_END(m->name);
+    Sigprocmask(SIG_SETMASK, &prev, NULL);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* report - Prints the statistics of the @n round trips in rtt */
+static void report(char *name, int n)
+{
+    double sum = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+        sum += rtt[i];
+    qsort(rtt, n, sizeof(double), cmp_double);
+    printf("%-12s %10.2f %10.2f %10.2f %12.0f\n", name,
+           rtt[n / 2] * 1e6, rtt[(long)n * 99 / 100] * 1e6, rtt[n - 1] * 1e6,
+           2 * n / sum);
+}
+
+int main(int argc, char **argv)
+{
+    static method_t methods[] = {
+        {"sigsuspend", SIG, init_sigsuspend, wait_sigsuspend, send_kill,
+         fini_sigsuspend},
+        {"sigwaitinfo", SIG, nop, wait_sigwaitinfo, send_kill, nop},
+        {"signalfd", SIG, init_signalfd, wait_signalfd, send_kill,
+         fini_signalfd},
+        {"epoll", SIG, init_epoll, wait_epoll, send_kill, fini_epoll},
+        {"rt queued", 0, init_rt, wait_rt, send_rt, nop},
+    };
+    int i, c, n = 100000;
+    cpu_set_t cpus;
+
+    while ((c = getopt(argc, argv, "1")) != -1) {
+        if (c != '1') {
+            fprintf(stderr, "usage: %s [-1] [N]\n", argv[0]);
+            exit(1);
+        }
+        CPU_ZERO(&cpus);
+        CPU_SET(0, &cpus);
+        if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0)
+            unix_error("sched_setaffinity error");
+    }
+    if (optind < argc && (n = atoi(argv[optind])) <= 0)
+        n = 1;
+    total = n + WARMUP;
+    rtt = Malloc(n * sizeof(double));
+    methods[4].signum = Sigrt(0);   /* Not a constant */
+
+    /* Before the first fork, or the peer of the handler run goes uncounted */
+    perf_open(1);
+
+    printf("%d round trips, times in us\n", n);
+    printf("%-12s %10s %10s %10s %12s\n", "method", "median", "p99", "max",
+           "signals/s");
+
+    Sigemptyset(&mask);
+    Sigaddset(&mask, SIG);
+    run_handler();
+    report("handler", n);
+
+    for (i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+        Sigemptyset(&mask);
+        Sigaddset(&mask, methods[i].signum);
+        run(&methods[i]);
+        report(methods[i].name, n);
+    }
+    perf_report(stdout);
+    Free(rtt);
+    return 0;
+}
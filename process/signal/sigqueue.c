@@ -0,0 +1,57 @@
+#include "common.h"
+
+#define NCHILDREN (10)
+
+/*
+ * signal2.c without its flaw. There, SIGCHLDs that arrive while one is
+ * pending are merged, so one handler call must reap every child it can.
+ * Here each child announces its exit with a queued real-time signal that
+ * carries its number: one signal per child, none lost, and the SA_SIGINFO
+ * handler knows from si_pid which child to reap.
+ */
+
+static volatile sig_atomic_t nreaped;
+
+/* Real-time signal handler, once per child */
+void handler(int signum, siginfo_t *info, void *context)
+{
+    int olderrno = errno;
+
+    /* The sender is exiting right after the signal */
+    if (waitpid(info->si_pid, NULL, 0) < 0)
+        sio_error("waitpid error");
+    sio_puts("Handler reaped child ");
+    sio_putl(info->si_value.sival_int);
+    sio_puts(" (pid ");
+    sio_putl(info->si_pid);
+    sio_puts(")\n");
+    nreaped++;
+    errno = olderrno;
+}
+
+int main()
+{
+    sigset_t mask, prev;
+    union sigval value;
+    int i;
+
+    Signal_info(Sigrt(0), handler);
+    Sigemptyset(&mask);
+    Sigaddset(&mask, Sigrt(0));
+
+    /* All signals stay pending until everybody is forked */
+    Sigprocmask(SIG_BLOCK, &mask, &prev);
+    for (i = 0; i < NCHILDREN; i++) {
+        if (Fork() == 0) {
+            value.sival_int = i;
+            Sigqueue(getppid(), Sigrt(0), value);
+            exit(0);
+        }
+    }
+
+    while (nreaped < NCHILDREN)
+        Sigsuspend(&prev);
+    Sigprocmask(SIG_SETMASK, &prev, NULL);
+    printf("All %d children reaped\n", NCHILDREN);
+    return 0;
+}
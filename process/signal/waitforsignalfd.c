@@ -0,0 +1,54 @@
+#include "common.h"
+
+/*
+ * Same job as waitforsignal.c, but SIGCHLD is read from a signalfd by an
+ * event loop instead of being handled asynchronously. The parent sleeps
+ * in epoll_wait until the child exits, nothing is spinning.
+ */
+
+static pid_t pid;
+
+/* SIGCHLD event, runs in normal context */
+void sigchld_event(ev_loop_t *loop, const struct signalfd_siginfo *info,
+                   void *arg)
+{
+    pid_t retpid;
+
+    while ((retpid = waitpid(-1, NULL, WNOHANG)) > 0)
+        pid = retpid;
+}
+
+/* SIGINT event */
+void sigint_event(ev_loop_t *loop, const struct signalfd_siginfo *info,
+                  void *arg)
+{
+    printf("Caught SIGINT!\n");
+    exit(0);
+}
+
+int main()
+{
+    ev_loop_t loop;
+
+    /* Route SIGCHLD & SIGINT through the event loop */
+    ev_init(&loop);
+    ev_add_signal(&loop, SIGCHLD, sigchld_event, NULL);
+    ev_add_signal(&loop, SIGINT, sigint_event, NULL);
+
+    while (1) {
+        /* Fork a child, SIGCHLD is already blocked */
+        if (Fork() == 0) /* Child */
+            exit(0);
+
+        /* Parent sleeps until the child has been reaped */
+        pid = 0;
+        while (!pid)
+            ev_run_once(&loop, -1);
+
+        /* Do some work after receiving SIGCHLD */
+        printf(".");
+        fflush(stdout);
+    }
+
+    return 0;
+}
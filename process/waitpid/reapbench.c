@@ -0,0 +1,235 @@
+#include "common.h"
+
+/**
+ * reapbench - Forks N children that exit immediately and measures how fast
+ * the parent can create and reap them with different SIGCHLD strategies:
+ *
+ *   handler     the SIGCHLD handler reaps asynchronously, main sleeps in
+ *               sigsuspend until everybody is gone.
+ *   sigsuspend  SIGCHLD is blocked, main sleeps in sigsuspend and reaps in
+ *               normal context with reap_batch.
+ *   signalfd    SIGCHLD is read from a signalfd by an event loop whose
+ *               handler reaps with reap_batch.
+ *
+ * For each run it reports the fork rate, the overall rate at which children
+ * are created, exit and get reaped, the time spent draining the children
+ * still around after the last fork, and the CPU time of the children
+ * (from their rusage) and of the parent. The performance counters of each
+ * strategy follow, over all the runs. They count the parent only: copying
+ * them into every child would slow the forks down.
+ *
+ * usage: reapbench [N ...]     (default: 10 100 1000 10000 100000)
+ */
+#define BATCH (256)
+
+static volatile sig_atomic_t nreaped;   /* Children reaped so far */
+static volatile sig_atomic_t got_chld;  /* SIGCHLD seen since last reap */
+static long cpu_usec;                   /* Sum of the children's CPU time */
+static double forked_at;                /* When the last fork returned */
+
+/* account - Adds up a batch of reaped children */
+static void account(reap_t *rs, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        cpu_usec += rs[i].rusage.ru_utime.tv_sec * 1000000L
+            + rs[i].rusage.ru_utime.tv_usec
+            + rs[i].rusage.ru_stime.tv_sec * 1000000L
+            + rs[i].rusage.ru_stime.tv_usec;
+    nreaped += n;
+}
+
+/* reap_all - Reaps every child that is ready */
+static void reap_all(void)
+{
+    reap_t rs[BATCH];
+    int n;
+
+    do {
+        n = reap_batch(rs, BATCH);
+        account(rs, n);
+    } while (n == BATCH);
+}
+
+/* spawn - Forks a child that exits at once. Returns 0 if out of processes */
+static int spawn(void)
+{
+    pid_t pid;
+
+    if ((pid = fork()) == 0)
+        _exit(0);
+    if (pid < 0) {
+        if (errno != EAGAIN)
+            unix_error("fork error");
+        return 0;
+    }
+    return 1;
+}
+
+
+/* Strategy: reap in the handler */
+void reaping_handler(int signum)
+{
+    int olderrno = errno;
+    reap_all();
+    errno = olderrno;
+}
+
+static void run_handler(int n)
+{
+    sigset_t mask, prev;
+    int i;
+
+    Sigemptyset(&mask);
+    Sigaddset(&mask, SIGCHLD);
+    Signal(SIGCHLD, reaping_handler);
+
+    for (i = 0; i < n; ) {
+        if (spawn()) {
+            i++;
+            continue;
+        }
+
+        /*
+         * Wait for the handler to free a process slot. With SIGCHLD
+         * blocked, a child that exits after the retry stays pending for
+         * Sigsuspend, and one reaped before it has freed the slot.
+         */
+        Sigprocmask(SIG_BLOCK, &mask, &prev);
+        if (spawn())
+            i++;
+        else
+            Sigsuspend(&prev);
+        Sigprocmask(SIG_SETMASK, &prev, NULL);
+    }
+    forked_at = clock_now();
+
+    Sigprocmask(SIG_BLOCK, &mask, &prev);
+    while (nreaped < n)
+        Sigsuspend(&prev);
+    Sigprocmask(SIG_SETMASK, &prev, NULL);
+    Signal(SIGCHLD, SIG_DFL);
+}
+
+
+/* Strategy: sigsuspend, then reap in normal context */
+void flag_handler(int signum)
+{
+    got_chld = 1;
+}
+
+static void run_sigsuspend(int n)
+{
+    sigset_t mask, prev;
+    int i;
+
+    Sigemptyset(&mask);
+    Sigaddset(&mask, SIGCHLD);
+    Signal(SIGCHLD, flag_handler);
+    Sigprocmask(SIG_BLOCK, &mask, &prev);
+
+    for (i = 0; i < n; ) {
+        if (spawn())
+            i++;
+        else {
+            while (!got_chld)
+                Sigsuspend(&prev);
+            got_chld = 0;
+            reap_all();
+        }
+    }
+    forked_at = clock_now();
+
+    while (nreaped < n) {
+        reap_all();
+        if (nreaped < n) {
+            while (!got_chld)
+                Sigsuspend(&prev);
+            got_chld = 0;
+        }
+    }
+    Sigprocmask(SIG_SETMASK, &prev, NULL);
+    Signal(SIGCHLD, SIG_DFL);
+}
+
+
+/* Strategy: signalfd + event loop */
+void sigchld_event(ev_loop_t *loop, const struct signalfd_siginfo *info,
+                   void *arg)
+{
+    reap_all();
+}
+
+static void run_signalfd(int n)
+{
+    ev_loop_t loop;
+    int i;
+
+    ev_init(&loop);
+    ev_add_signal(&loop, SIGCHLD, sigchld_event, NULL);
+
+    for (i = 0; i < n; ) {
+        if (spawn())
+            i++;
+        else
+            ev_run_once(&loop, -1);
+    }
+    forked_at = clock_now();
+
+    while (nreaped < n)
+        ev_run_once(&loop, -1);
+    ev_close(&loop);
+}
+
+
+/* self_cpu - Returns the CPU time used by this process in seconds */
+static double self_cpu(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6
+        + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static void bench(char *name, void (*run)(int), int n)
+{
+    double start, end, cpu;
+
+    nreaped = 0;
+    got_chld = 0;
+    cpu_usec = 0;
+
+    cpu = self_cpu();
+    PERF_BEGIN(name);
+    start = clock_now();
+    run(n);
+    end = clock_now();
+    PERF_END(name);
+    cpu = self_cpu() - cpu;
+
+    printf("%-10s %7d %10.0f %10.0f %10.3f %12.3f %12.3f\n",
+           name, n, n / (forked_at - start), n / (end - start),
+           (end - forked_at) * 1e3, cpu_usec / 1e3, cpu * 1e3);
+}
+
+int main(int argc, char **argv)
+{
+    static int defaults[] = {10, 100, 1000, 10000, 100000};
+    int i, n, nruns;
+
+    nruns = (argc > 1) ? argc - 1 : sizeof(defaults) / sizeof(int);
+    perf_open(0);
+
+    printf("%-10s %7s %10s %10s %10s %12s %12s\n", "strategy", "N",
+           "forks/s", "reaps/s", "drain ms", "child cpu ms", "self cpu ms");
+    for (i = 0; i < nruns; i++) {
+        n = (argc > 1) ? atoi(argv[i + 1]) : defaults[i];
+        bench("handler", run_handler, n);
+        bench("sigsuspend", run_sigsuspend, n);
+        bench("signalfd", run_signalfd, n);
+    }
+    perf_report(stdout);
+    return 0;
+}
@@ -0,0 +1,46 @@
+#include "common.h"
+
+/**
+ * Parent creates N children that run for different amounts of time and
+ * reaps each one as soon as it terminates, whatever the creation order.
+ * Children still running after TIMEOUT milliseconds are killed through
+ * their pidfd.
+ */
+#define N (4)
+#define TIMEOUT (1500)
+
+int main(void)
+{
+    child_t children[N];
+    int i, status;
+
+    /* Parent creates N children, the first one hangs */
+    for (i = 0; i < N; ++i) {
+        if (child_fork(&children[i]) == 0) { /* Child */
+            Sleep(i == 0 ? 30 : i);
+            exit(100 + i);
+        }
+    }
+
+    /* Parent reaps its children in the order they terminate */
+    while ((i = child_wait_any(children, N, TIMEOUT)) >= 0) {
+        status = children[i].status;
+        if (WIFEXITED(status))
+            printf("child %d terminated normally with exit status=%d\n",
+                    children[i].pid, WEXITSTATUS(status));
+        else
+            printf("child %d terminated abnormally\n", children[i].pid);
+    }
+
+    /* Timed out: kill and reap the stragglers */
+    for (i = 0; i < N; ++i) {
+        if (!children[i].reaped) {
+            printf("child %d timed out, killing it\n", children[i].pid);
+            child_kill(&children[i], SIGKILL);
+            child_wait(&children[i], -1);
+        }
+        child_close(&children[i]);
+    }
+
+    return 0;
+}
@@ -2,6 +2,16 @@
  * common.c - common routines for Unix programming.
  */
 #include "common.h"
+#include <sys/syscall.h>
+#include <linux/sched.h>        /* struct clone_args */
+#include <linux/futex.h>
+#include <limits.h>
+#include <ctype.h>
+#include <time.h>
+#include <stdint.h>
+#include <stddef.h>            /* offsetof */
+#include <sys/file.h>          /* flock */
+#include <linux/perf_event.h>
 
 /*****************************************************************************************
  * Custom error handlers.
@@ -98,6 +108,186 @@ pid_t Getpgrp(void)
 }
 
 
+/*****************************************************************************************
+ * Wrappers for Linux pidfd functions.
+ * ***************************************************************************************/
+int Pidfd_open(pid_t pid, unsigned int flags)
+{
+    int fd;
+    if ((fd = pidfd_open(pid, flags)) < 0)
+        unix_error("Pidfd_open error");
+    return fd;
+}
+
+void Pidfd_send_signal(int pidfd, int sig, siginfo_t *info, unsigned int flags)
+{
+    if (pidfd_send_signal(pidfd, sig, info, flags) < 0)
+        unix_error("Pidfd_send_signal error");
+}
+
+/**
+ * Poll - Like poll, but an interrupted poll is not an error; it simply
+ * returns 0 ready descriptors.
+ */
+int Poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    int n;
+    if ((n = poll(fds, nfds, timeout)) < 0) {
+        if (errno != EINTR)
+            unix_error("Poll error");
+        n = 0;
+    }
+    return n;
+}
+
+
+/*****************************************************************************************
+ * Child handles.
+ * ***************************************************************************************/
+pid_t child_fork(child_t *c)
+{
+    struct clone_args args;
+    pid_t pid;
+    int fd = -1;
+
+    memset(&args, 0, sizeof(args));
+    args.flags = CLONE_PIDFD;
+    args.pidfd = (unsigned long)&fd;
+    args.exit_signal = SIGCHLD;
+
+    if ((pid = syscall(SYS_clone3, &args, sizeof(args))) < 0) {
+        if (errno != ENOSYS && errno != EPERM)
+            unix_error("child_fork error");
+
+        /*
+         * No clone3 (or filtered out). The child cannot be reaped behind
+         * our back before pidfd_open as long as nobody calls wait(-1).
+         */
+        if ((pid = Fork()) > 0)
+            fd = Pidfd_open(pid, 0);
+    }
+
+    if (pid == 0)
+        return 0;
+
+    c->pid = pid;
+    c->fd = fd;
+    c->status = 0;
+    c->reaped = 0;
+    return pid;
+}
+
+/**
+ * child_reap - Reaps a child whose pidfd has become readable.
+ */
+static void child_reap(child_t *c)
+{
+    Waitpid(c->pid, &c->status, 0);
+    c->reaped = 1;
+}
+
+/**
+ * child_poll - Polls @pfds like Poll, but a signal does not cut the wait
+ * short: it goes on for what is left of @timeout milliseconds.
+ */
+static int child_poll(struct pollfd *pfds, int n, int timeout)
+{
+    double deadline = clock_now() + timeout / 1e3;
+    int ready;
+
+    while ((ready = poll(pfds, n, timeout)) < 0) {
+        if (errno != EINTR)
+            unix_error("child_poll error");
+        if (timeout > 0 && (timeout = (deadline - clock_now()) * 1e3) < 0)
+            timeout = 0;
+    }
+    return ready;
+}
+
+int child_wait(child_t *c, int timeout)
+{
+    struct pollfd pfd;
+
+    if (c->reaped)
+        return 1;
+
+    pfd.fd = c->fd;
+    pfd.events = POLLIN;
+    if (child_poll(&pfd, 1, timeout) == 0)
+        return 0;
+    child_reap(c);
+    return 1;
+}
+
+int child_wait_any(child_t *cs, int n, int timeout)
+{
+    struct pollfd *pfds;
+    int *idx;
+    int i, m, ret = -1;
+
+    pfds = Malloc(n * sizeof(struct pollfd));
+    idx = Malloc(n * sizeof(int));
+
+    /* Poll only the children that are still around */
+    for (i = 0, m = 0; i < n; i++) {
+        if (cs[i].reaped)
+            continue;
+        pfds[m].fd = cs[i].fd;
+        pfds[m].events = POLLIN;
+        pfds[m].revents = 0;
+        idx[m++] = i;
+    }
+
+    if (m > 0 && child_poll(pfds, m, timeout) > 0) {
+        for (i = 0; i < m; i++) {
+            if (pfds[i].revents) {
+                ret = idx[i];
+                child_reap(&cs[ret]);
+                break;
+            }
+        }
+    }
+
+    Free(pfds);
+    Free(idx);
+    return ret;
+}
+
+void child_kill(child_t *c, int signum)
+{
+    if (c->reaped)
+        return;
+    /* ESRCH: the child has exited but is not reaped yet */
+    if (pidfd_send_signal(c->fd, signum, NULL, 0) < 0 && errno != ESRCH)
+        unix_error("child_kill error");
+}
+
+void child_close(child_t *c)
+{
+    if (c->fd >= 0)
+        close(c->fd);
+    c->fd = -1;
+}
+
+
+/*****************************************************************************************
+ * Batch reaping.
+ * ***************************************************************************************/
+int reap_batch(reap_t *rs, int n)
+{
+    int i = 0;
+    pid_t pid = 0;
+
+    /* wait4 is waitid(P_ALL, WEXITED | WNOHANG) plus the child's rusage */
+    while (i < n && (pid = wait4(-1, &rs[i].status, WNOHANG, &rs[i].rusage)) > 0)
+        rs[i++].pid = pid;
+
+    if (i == 0 && pid < 0 && errno != ECHILD)
+        unix_error("reap_batch error");
+    return i;
+}
+
+
 /*****************************************************************************************
  * Wrappers for Unix signal functions.
  * ***************************************************************************************/
@@ -158,6 +348,42 @@ int Sigsuspend(const sigset_t *set)
     return ret;
 }
 
+siginfo_handler_t *Signal_info(int signum, siginfo_handler_t *handler)
+{
+    struct sigaction action, old_action;
+
+    action.sa_sigaction = handler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+
+    if (sigaction(signum, &action, &old_action) < 0)
+        unix_error("Signal_info error");
+    return old_action.sa_sigaction;
+}
+
+void Sigqueue(pid_t pid, int signum, const union sigval value)
+{
+    if (sigqueue(pid, signum, value) < 0)
+        unix_error("Sigqueue error");
+}
+
+int Sigwaitinfo(const sigset_t *set, siginfo_t *info)
+{
+    int signum;
+
+    while ((signum = sigwaitinfo(set, info)) < 0)
+        if (errno != EINTR)
+            unix_error("Sigwaitinfo error");
+    return signum;
+}
+
+int Sigrt(int n)
+{
+    if (n < 0 || n > SIGRTMAX - SIGRTMIN)
+        app_error("Sigrt error: no such real-time signal");
+    return SIGRTMIN + n;
+}
+
 
 /*****************************************************************************************
  * Signal safe I/O routines
@@ -289,6 +515,14 @@ char *Fgets(char *str, int size, FILE *stream)
 /*****************************************************************************************
  * Wrappers for Unix I/O routines.
  * ***************************************************************************************/
+int Open(const char *pathname, int flags, mode_t mode)
+{
+    int fd;
+    if ((fd = open(pathname, flags, mode)) < 0)
+        unix_error("Open error");
+    return fd;
+}
+
 ssize_t Read(int fd, void *buf, size_t nbyte)
 {
     ssize_t ret;
@@ -297,6 +531,513 @@ ssize_t Read(int fd, void *buf, size_t nbyte)
     return ret;
 }
 
+void Close(int fd)
+{
+    if (close(fd) < 0)
+        unix_error("Close error");
+}
+
+int Dup2(int fd1, int fd2)
+{
+    int fd;
+    if ((fd = dup2(fd1, fd2)) < 0)
+        unix_error("Dup2 error");
+    return fd;
+}
+
+void Pipe(int fds[2])
+{
+    if (pipe(fds) < 0)
+        unix_error("Pipe error");
+}
+
+/*****************************************************************************************
+ * Zero-copy transfers.
+ * ***************************************************************************************/
+/**
+ * copy_fallback - Copies @in to @out (and to @fd unless it is -1) through
+ * a user buffer.
+ */
+static void copy_fallback(int in, int out, int fd)
+{
+    char buf[RIO_BUFSIZE];
+    ssize_t n;
+
+    while ((n = read(in, buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            unix_error("copy_fallback error");
+        }
+        Rio_writen(out, buf, n);
+        if (fd >= 0)
+            Rio_writen(fd, buf, n);
+    }
+}
+
+void splice_copy(int in, int out)
+{
+    ssize_t n;
+
+    /* Bigger pipes mean fewer splices; fails harmlessly on non-pipes */
+    fcntl(in, F_SETPIPE_SZ, SPLICE_CHUNK);
+    fcntl(out, F_SETPIPE_SZ, SPLICE_CHUNK);
+
+    while ((n = splice(in, NULL, out, NULL, SPLICE_CHUNK, SPLICE_F_MOVE)) != 0) {
+        if (n > 0 || errno == EINTR)
+            continue;
+        if (errno != EINVAL)
+            unix_error("splice_copy error");
+
+        /* Neither side is a pipe, or the file system cannot splice */
+        copy_fallback(in, out, -1);
+        return;
+    }
+}
+
+void tee_copy(int in, int out, int fd)
+{
+    ssize_t n, m;
+
+    fcntl(in, F_SETPIPE_SZ, SPLICE_CHUNK);
+    fcntl(out, F_SETPIPE_SZ, SPLICE_CHUNK);
+
+    while ((n = tee(in, out, SPLICE_CHUNK, 0)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EINVAL)
+                unix_error("tee_copy error");
+            copy_fallback(in, out, fd);
+            return;
+        }
+
+        /* tee left the data in @in, now move the same n bytes to @fd */
+        while (n > 0) {
+            if ((m = splice(in, NULL, fd, NULL, n, SPLICE_F_MOVE)) < 0) {
+                if (errno == EINTR)
+                    continue;
+                unix_error("tee_copy error");
+            }
+            n -= m;
+        }
+    }
+}
+
+/*****************************************************************************************
+ * Wrappers for Linux event notification functions.
+ * ***************************************************************************************/
+int Epoll_create1(int flags)
+{
+    int fd;
+    if ((fd = epoll_create1(flags)) < 0)
+        unix_error("Epoll_create1 error");
+    return fd;
+}
+
+void Epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
+{
+    if (epoll_ctl(epfd, op, fd, event) < 0)
+        unix_error("Epoll_ctl error");
+}
+
+/**
+ * Epoll_wait - Like epoll_wait, but an interrupted wait is not an error;
+ * it simply returns 0 events.
+ */
+int Epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+    int n;
+    if ((n = epoll_wait(epfd, events, maxevents, timeout)) < 0) {
+        if (errno != EINTR)
+            unix_error("Epoll_wait error");
+        n = 0;
+    }
+    return n;
+}
+
+int Signalfd(int fd, const sigset_t *mask, int flags)
+{
+    int ret;
+    if ((ret = signalfd(fd, mask, flags)) < 0)
+        unix_error("Signalfd error");
+    return ret;
+}
+
+/*****************************************************************************************
+ * The Rio package - Robust I/O functions.
+ * ***************************************************************************************/
+/**
+ * rio_readn - Robustly reads @n bytes (unbuffered).
+ *
+ * @return the number of bytes read, which is less than @n only on EOF,
+ * or -1 on error.
+ */
+ssize_t rio_readn(int fd, void *usrbuf, size_t n)
+{
+    size_t nleft = n;
+    ssize_t nread;
+    char *bufp = usrbuf;
+
+    while (nleft > 0) {
+        if ((nread = read(fd, bufp, nleft)) < 0) {
+            if (errno == EINTR)     /* Interrupted by sig handler return */
+                nread = 0;          /* and call read() again */
+            else
+                return -1;
+        }
+        else if (nread == 0)
+            break;                  /* EOF */
+        nleft -= nread;
+        bufp += nread;
+    }
+    return (n - nleft);
+}
+
+/**
+ * rio_writen - Robustly writes @n bytes (unbuffered).
+ */
+ssize_t rio_writen(int fd, void *usrbuf, size_t n)
+{
+    size_t nleft = n;
+    ssize_t nwritten;
+    char *bufp = usrbuf;
+
+    while (nleft > 0) {
+        if ((nwritten = write(fd, bufp, nleft)) <= 0) {
+            if (errno == EINTR)
+                nwritten = 0;
+            else
+                return -1;
+        }
+        nleft -= nwritten;
+        bufp += nwritten;
+    }
+    return n;
+}
+
+/**
+ * rio_fill - Refills the empty internal buffer with a single read(),
+ * restarted if interrupted.
+ *
+ * @return the number of bytes read, 0 on EOF, -1 on error.
+ */
+static int rio_fill(rio_t *rp)
+{
+    do {
+        rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, sizeof(rp->rio_buf));
+    } while (rp->rio_cnt < 0 && errno == EINTR);
+
+    rp->rio_bufptr = rp->rio_buf;
+    return rp->rio_cnt;
+}
+
+/**
+ * rio_read - This is a wrapper for the Unix read() function that
+ * transfers min(n, rio_cnt) bytes from an internal buffer to a user
+ * buffer, where n is the number of bytes requested by the user and
+ * rio_cnt is the number of unread bytes in the internal buffer. On
+ * entry, rio_read() refills the internal buffer via a call to
+ * read() if the internal buffer is empty.
+ */
+static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
+{
+    int cnt;
+
+    if (rp->rio_cnt <= 0 && rio_fill(rp) <= 0)
+        return rp->rio_cnt;         /* EOF (0) or error (-1) */
+
+    /* Copy min(n, rp->rio_cnt) bytes from internal buf to user buf */
+    cnt = n;
+    if (rp->rio_cnt < n)
+        cnt = rp->rio_cnt;
+    memcpy(usrbuf, rp->rio_bufptr, cnt);
+    rp->rio_bufptr += cnt;
+    rp->rio_cnt -= cnt;
+    return cnt;
+}
+
+/**
+ * rio_readinitb - Associates a descriptor with a read buffer and resets
+ * the buffer.
+ */
+void rio_readinitb(rio_t *rp, int fd)
+{
+    rp->rio_fd = fd;
+    rp->rio_cnt = 0;
+    rp->rio_bufptr = rp->rio_buf;
+}
+
+/**
+ * rio_readnb - Robustly reads @n bytes (buffered).
+ */
+ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n)
+{
+    size_t nleft = n;
+    ssize_t nread;
+    char *bufp = usrbuf;
+
+    while (nleft > 0) {
+        if ((nread = rio_read(rp, bufp, nleft)) < 0)
+            return -1;
+        else if (nread == 0)
+            break;                  /* EOF */
+        nleft -= nread;
+        bufp += nread;
+    }
+    return (n - nleft);
+}
+
+/**
+ * rio_readlineb - Robustly reads a text line (buffered). The newline, if
+ * any, is retained and the line is null-terminated.
+ *
+ * @return the number of bytes read, 0 on EOF, -1 on error.
+ */
+ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
+{
+    size_t n = 0, cnt;
+    char *bufp = usrbuf, *nl = NULL;
+
+    /* Copy whole runs of the internal buffer, up to the first newline */
+    while (nl == NULL && n + 1 < maxlen) {
+        if (rp->rio_cnt <= 0) {
+            if (rio_fill(rp) < 0)
+                return -1;          /* Error */
+            if (rp->rio_cnt == 0)
+                break;              /* EOF */
+        }
+        cnt = rp->rio_cnt;
+        if (cnt > maxlen - 1 - n)
+            cnt = maxlen - 1 - n;
+        if ((nl = memchr(rp->rio_bufptr, '\n', cnt)) != NULL)
+            cnt = nl - rp->rio_bufptr + 1;
+
+        memcpy(bufp, rp->rio_bufptr, cnt);
+        rp->rio_bufptr += cnt;
+        rp->rio_cnt -= cnt;
+        bufp += cnt;
+        n += cnt;
+    }
+    if (maxlen > 0)
+        *bufp = 0;
+    return n;
+}
+
+/*****************************************************************************************
+ * Wrappers for the Rio package.
+ * ***************************************************************************************/
+ssize_t Rio_readn(int fd, void *usrbuf, size_t n)
+{
+    ssize_t nbytes;
+    if ((nbytes = rio_readn(fd, usrbuf, n)) < 0)
+        unix_error("Rio_readn error");
+    return nbytes;
+}
+
+void Rio_writen(int fd, void *usrbuf, size_t n)
+{
+    if (rio_writen(fd, usrbuf, n) != n)
+        unix_error("Rio_writen error");
+}
+
+void Rio_readinitb(rio_t *rp, int fd)
+{
+    rio_readinitb(rp, fd);
+}
+
+ssize_t Rio_readnb(rio_t *rp, void *usrbuf, size_t n)
+{
+    ssize_t rc;
+    if ((rc = rio_readnb(rp, usrbuf, n)) < 0)
+        unix_error("Rio_readnb error");
+    return rc;
+}
+
+ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
+{
+    ssize_t rc;
+    if ((rc = rio_readlineb(rp, usrbuf, maxlen)) < 0)
+        unix_error("Rio_readlineb error");
+    return rc;
+}
+
+/*****************************************************************************************
+ * Event loop.
+ * ***************************************************************************************/
+void ev_init(ev_loop_t *loop)
+{
+    int i;
+
+    loop->epfd = Epoll_create1(EPOLL_CLOEXEC);
+    loop->sigfd = -1;
+    Sigemptyset(&loop->sigmask);
+    Sigprocmask(SIG_BLOCK, NULL, &loop->prevmask);
+    loop->watchers = NULL;
+    loop->nwatchers = 0;
+    loop->nalways = 0;
+    for (i = 0; i < NSIG; i++) {
+        loop->sigs[i].handler = NULL;
+        loop->sigs[i].arg = NULL;
+    }
+    loop->done = 0;
+}
+
+void ev_add_fd(ev_loop_t *loop, int fd, unsigned int events,
+               ev_fd_handler_t *handler, void *arg)
+{
+    struct epoll_event ev;
+    ev_watcher_t *w;
+    int n;
+
+    /* Grow the fd-indexed watcher table */
+    if (fd >= loop->nwatchers) {
+        n = loop->nwatchers ? loop->nwatchers : 16;
+        while (n <= fd)
+            n *= 2;
+        loop->watchers = Realloc(loop->watchers, n * sizeof(ev_watcher_t));
+        memset(loop->watchers + loop->nwatchers, 0,
+               (n - loop->nwatchers) * sizeof(ev_watcher_t));
+        loop->nwatchers = n;
+    }
+
+    ev_del_fd(loop, fd);
+    w = &loop->watchers[fd];
+
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        /* epoll refuses regular files and directories; they never block */
+        if (errno != EPERM)
+            unix_error("ev_add_fd error");
+        w->always_ready = 1;
+        loop->nalways++;
+    }
+    w->handler = handler;
+    w->arg = arg;
+    w->events = events;
+}
+
+void ev_del_fd(ev_loop_t *loop, int fd)
+{
+    ev_watcher_t *w;
+
+    if (fd >= loop->nwatchers || loop->watchers[fd].handler == NULL)
+        return;
+
+    w = &loop->watchers[fd];
+    if (w->always_ready)
+        loop->nalways--;
+    else
+        Epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+    w->handler = NULL;
+    w->arg = NULL;
+    w->always_ready = 0;
+}
+
+void ev_add_signal(ev_loop_t *loop, int signum, ev_sig_handler_t *handler,
+                   void *arg)
+{
+    struct epoll_event ev;
+    int first = (loop->sigfd < 0);
+
+    Sigaddset(&loop->sigmask, signum);
+    Sigprocmask(SIG_BLOCK, &loop->sigmask, NULL);
+    loop->sigfd = Signalfd(loop->sigfd, &loop->sigmask,
+                           SFD_NONBLOCK | SFD_CLOEXEC);
+    if (first) {
+        ev.events = EPOLLIN;
+        ev.data.fd = loop->sigfd;
+        Epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->sigfd, &ev);
+    }
+    loop->sigs[signum].handler = handler;
+    loop->sigs[signum].arg = arg;
+}
+
+/**
+ * ev_dispatch_signals - Drains the signalfd and calls the handler of
+ * every signal read from it.
+ */
+static int ev_dispatch_signals(ev_loop_t *loop)
+{
+    struct signalfd_siginfo info;
+    ssize_t n;
+    int cnt = 0;
+
+    while ((n = read(loop->sigfd, &info, sizeof(info))) == sizeof(info)) {
+        if (loop->sigs[info.ssi_signo].handler != NULL)
+            loop->sigs[info.ssi_signo].handler(loop, &info,
+                                               loop->sigs[info.ssi_signo].arg);
+        cnt++;
+    }
+    if (n < 0 && errno != EAGAIN && errno != EINTR)
+        unix_error("ev_dispatch_signals error");
+    return cnt;
+}
+
+int ev_run_once(ev_loop_t *loop, int timeout)
+{
+    struct epoll_event events[EV_MAXEVENTS];
+    ev_watcher_t *w;
+    int i, fd, n, cnt = 0;
+
+    /* Never sleep while an always-ready descriptor is being watched */
+    if (loop->nalways > 0)
+        timeout = 0;
+
+    n = Epoll_wait(loop->epfd, events, EV_MAXEVENTS, timeout);
+    for (i = 0; i < n; i++) {
+        fd = events[i].data.fd;
+        if (fd == loop->sigfd) {
+            cnt += ev_dispatch_signals(loop);
+            continue;
+        }
+        /* A previous handler may have removed this watcher */
+        if (fd >= loop->nwatchers || (w = &loop->watchers[fd])->handler == NULL)
+            continue;
+        w->handler(loop, fd, events[i].events, w->arg);
+        cnt++;
+    }
+
+    for (fd = 0; loop->nalways > 0 && fd < loop->nwatchers; fd++) {
+        w = &loop->watchers[fd];
+        if (w->handler != NULL && w->always_ready) {
+            w->handler(loop, fd, w->events, w->arg);
+            cnt++;
+        }
+    }
+    return cnt;
+}
+
+void ev_run(ev_loop_t *loop)
+{
+    loop->done = 0;
+    while (!loop->done)
+        ev_run_once(loop, -1);
+}
+
+void ev_stop(ev_loop_t *loop)
+{
+    loop->done = 1;
+}
+
+void ev_child_reset(ev_loop_t *loop)
+{
+    Sigprocmask(SIG_SETMASK, &loop->prevmask, NULL);
+}
+
+void ev_close(ev_loop_t *loop)
+{
+    if (loop->sigfd >= 0)
+        close(loop->sigfd);
+    close(loop->epfd);
+    Free(loop->watchers);
+    loop->watchers = NULL;
+    loop->nwatchers = 0;
+    loop->nalways = 0;
+    Sigprocmask(SIG_SETMASK, &loop->prevmask, NULL);
+}
+
 /*****************************************************************************************
  * Wrappers for dynamic storage allocation functions.
  * ***************************************************************************************/
@@ -324,7 +1065,2125 @@ void *Calloc(size_t nmemb, size_t size)
     return p;
 }
 
-void *Free(void *ptr)
+void Free(void *ptr)
 {
     free(ptr);
 }
+
+/*****************************************************************************************
+ * Command path cache.
+ * ***************************************************************************************/
+typedef struct path_entry {
+    char *name;                 /* Command name */
+    char *path;                 /* What it resolves to */
+    long hits;                  /* Lookups served from the cache */
+    struct path_entry *next;    /* Next entry in the bucket */
+} path_entry_t;
+
+static path_entry_t *path_table[PATH_HASHSIZE];
+static char *path_env;          /* PATH the cached entries were found with */
+
+/**
+ * path_hash - FNV-1a hash of a null-terminated string.
+ */
+static unsigned int path_hash(char *s)
+{
+    unsigned int h = 2166136261u;
+
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h % PATH_HASHSIZE;
+}
+
+/**
+ * path_search - Probes the directories of @pathenv for command @name.
+ *
+ * @return a malloc'ed path, or NULL if @name is not found.
+ */
+static char *path_search(char *name, char *pathenv)
+{
+    struct stat sb;
+    char *dir, *end, *buf;
+    size_t dirlen, namelen = strlen(name);
+
+    buf = Malloc(strlen(pathenv) + namelen + 3);
+    for (dir = pathenv; ; dir = end + 1) {
+        if ((end = strchr(dir, ':')) == NULL)
+            end = dir + strlen(dir);
+
+        /* An empty entry stands for the current directory */
+        dirlen = end - dir;
+        if (dirlen == 0) {
+            buf[0] = '.';
+            dirlen = 1;
+        }
+        else
+            memcpy(buf, dir, dirlen);
+        buf[dirlen] = '/';
+        memcpy(buf + dirlen + 1, name, namelen + 1);
+
+        if (stat(buf, &sb) == 0 && S_ISREG(sb.st_mode) && access(buf, X_OK) == 0)
+            return buf;
+        if (*end == '\0')
+            break;
+    }
+    Free(buf);
+    return NULL;
+}
+
+char *path_lookup(char *name)
+{
+    path_entry_t *e;
+    unsigned int h;
+    char *pathenv, *path;
+
+    if (strchr(name, '/') != NULL)
+        return name;
+
+    /* A new PATH invalidates everything found with the old one */
+    if ((pathenv = getenv("PATH")) == NULL)
+        pathenv = "/bin:/usr/bin";
+    if (path_env == NULL || strcmp(path_env, pathenv) != 0) {
+        path_clear();
+        path_env = strdup(pathenv);
+    }
+
+    h = path_hash(name);
+    for (e = path_table[h]; e != NULL; e = e->next) {
+        if (strcmp(e->name, name) == 0) {
+            e->hits++;
+            return e->path;
+        }
+    }
+
+    if ((path = path_search(name, pathenv)) == NULL)
+        return NULL;
+
+    e = Malloc(sizeof(path_entry_t));
+    e->name = strdup(name);
+    e->path = path;
+    e->hits = 0;
+    e->next = path_table[h];
+    path_table[h] = e;
+    return path;
+}
+
+void path_forget(char *name)
+{
+    path_entry_t **ep, *e;
+
+    for (ep = &path_table[path_hash(name)]; (e = *ep) != NULL; ep = &e->next) {
+        if (strcmp(e->name, name) == 0) {
+            *ep = e->next;
+            Free(e->name);
+            Free(e->path);
+            Free(e);
+            return;
+        }
+    }
+}
+
+void path_clear(void)
+{
+    path_entry_t *e, *next;
+    int i;
+
+    for (i = 0; i < PATH_HASHSIZE; i++) {
+        for (e = path_table[i]; e != NULL; e = next) {
+            next = e->next;
+            Free(e->name);
+            Free(e->path);
+            Free(e);
+        }
+        path_table[i] = NULL;
+    }
+    Free(path_env);
+    path_env = NULL;
+}
+
+void path_print(void)
+{
+    path_entry_t *e;
+    int i, n = 0;
+
+    for (i = 0; i < PATH_HASHSIZE; i++) {
+        for (e = path_table[i]; e != NULL; e = e->next) {
+            if (n++ == 0)
+                printf("hits\tcommand\n");
+            printf("%4ld\t%s\n", e->hits, e->path);
+        }
+    }
+    if (n == 0)
+        printf("hash: hash table empty\n");
+}
+
+
+/*****************************************************************************************
+ * Command line tokenizer.
+ * ***************************************************************************************/
+#define TOK_INITCAP (32)            /* Initial room in a token list */
+
+static char tok_ops[][2] = {"", "<", ">", "|", "&"};    /* Indexed by type */
+
+/*
+ * Characters that end a run of plain ones. A table lookup per byte beats
+ * both strcspn, which builds such a table on every call, and 16-byte SSE2
+ * compares: words are short, and vector loads stall on the bytes that
+ * reading the line and terminating the previous words have just stored.
+ */
+static const unsigned char tok_delim[256] = {
+    ['\0'] = 1, [' '] = 1, ['\t'] = 1, ['\n'] = 1, ['<'] = 1, ['>'] = 1,
+    ['|'] = 1, ['&'] = 1, ['\''] = 1, ['"'] = 1, ['\\'] = 1
+};
+
+/**
+ * tok_span - Returns the length of the run of plain characters at @s.
+ */
+static inline size_t tok_span(const char *s)
+{
+    const char *p = s;
+
+    while (!tok_delim[(unsigned char)*p])
+        p++;
+    return p - s;
+}
+
+void tok_init(tokens_t *t)
+{
+    t->n = 0;
+    t->cap = TOK_INITCAP;
+    t->argv = Malloc((t->cap + 1) * sizeof(char *));
+    t->types = Malloc(t->cap * sizeof(int));
+    t->argv[0] = NULL;
+}
+
+/**
+ * tok_push - Appends token @s of type @type to @t.
+ */
+static void tok_push(tokens_t *t, char *s, int type)
+{
+    if (t->n == t->cap) {
+        t->cap *= 2;
+        t->argv = Realloc(t->argv, (t->cap + 1) * sizeof(char *));
+        t->types = Realloc(t->types, t->cap * sizeof(int));
+    }
+    t->argv[t->n] = s;
+    t->types[t->n++] = type;
+}
+
+int tokenize(char *buf, tokens_t *t)
+{
+    char *r = buf;      /* Next character to read */
+    char *w;            /* Where the next character of the word goes */
+    char *end = NULL;   /* Where the last word ends, once r has moved on */
+    size_t len;
+    int c, type;
+
+    t->n = 0;
+    while (1) {
+        /*
+         * A word is terminated only now: w may be the very delimiter that
+         * ended it, which must be read first.
+         */
+        c = *r;
+        if (end != NULL) {
+            *end = '\0';
+            end = NULL;
+        }
+
+        switch (c) {
+            case ' ':
+            case '\t':
+            case '\n':
+                r++;
+                continue;
+            case '\0':
+            case '#':           /* Comment */
+                t->argv[t->n] = NULL;
+                return t->n;
+            case '<':
+                type = TOK_IN;
+                break;
+            case '>':
+                type = TOK_OUT;
+                break;
+            case '|':
+                type = TOK_PIPE;
+                break;
+            case '&':
+                type = TOK_BG;
+                break;
+            default:
+                type = TOK_WORD;
+        }
+        if (type != TOK_WORD) {
+            tok_push(t, tok_ops[type], type);
+            r++;
+            continue;
+        }
+
+        /*
+         * Copy the word down to w piece by piece. Until the first quote
+         * or escape, w == r and nothing moves at all.
+         */
+        tok_push(t, w = r, TOK_WORD);
+        while (1) {
+            len = tok_span(r);
+            if (w != r)
+                memmove(w, r, len);
+            w += len;
+            r += len;
+
+            if (*r == '\'') {
+                r++;
+                len = strchrnul(r, '\'') - r;
+                if (r[len] == '\0')
+                    return -1;
+                memmove(w, r, len);
+                w += len;
+                r += len + 1;
+            }
+            else if (*r == '"') {
+                r++;
+                while (*r != '"') {
+                    len = strcspn(r, "\"\\");
+                    memmove(w, r, len);
+                    w += len;
+                    r += len;
+                    if (*r == '\0')
+                        return -1;
+                    if (*r == '\\') {
+                        if (r[1] == '"' || r[1] == '\\')
+                            r++;
+                        *w++ = *r++;
+                    }
+                }
+                r++;
+            }
+            else if (*r == '\\') {
+                /* A backslash at the end of the line is dropped */
+                if (*++r != '\0' && *r != '\n')
+                    *w++ = *r++;
+            }
+            else
+                break;      /* Blank, operator or end of line */
+        }
+        end = w;
+    }
+}
+
+void tok_free(tokens_t *t)
+{
+    Free(t->argv);
+    Free(t->types);
+}
+
+/*****************************************************************************************
+ * Shell builtins.
+ * ***************************************************************************************/
+static int builtin_cmp(const void *key, const void *elem)
+{
+    return strcmp(key, ((const builtin_t *)elem)->name);
+}
+
+builtin_t *builtin_find(builtin_t *table, int n, char *name)
+{
+    return bsearch(name, table, n, sizeof(builtin_t), builtin_cmp);
+}
+
+/**
+ * redirect_fd - Makes file @file, opened with @flags, descriptor @fd.
+ *
+ * @return a copy of the former @fd to restore it from, or -1 after
+ * printing an error.
+ */
+static int redirect_fd(char *file, int flags, int fd)
+{
+    int newfd, oldfd;
+
+    if ((newfd = open(file, flags, 0666)) < 0) {
+        fprintf(stderr, "%s: %s\n", file, strerror(errno));
+        return -1;
+    }
+    oldfd = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+    Dup2(newfd, fd);
+    Close(newfd);
+    return oldfd;
+}
+
+int builtin_run(builtin_fn_t *fn, char **argv, char *in, char *out)
+{
+    int oldin = -1, oldout = -1, status = 1;
+
+    if (in != NULL && (oldin = redirect_fd(in, O_RDONLY, STDIN_FILENO)) < 0)
+        return 1;
+    if (out != NULL) {
+        fflush(stdout);     /* Output so far is not the builtin's */
+        oldout = redirect_fd(out, O_WRONLY | O_CREAT | O_TRUNC, STDOUT_FILENO);
+        if (oldout < 0)
+            goto restore;
+    }
+
+    status = fn(argv);
+
+    if (oldout >= 0) {
+        fflush(stdout);
+        Dup2(oldout, STDOUT_FILENO);
+        Close(oldout);
+    }
+restore:
+    if (oldin >= 0) {
+        Dup2(oldin, STDIN_FILENO);
+        Close(oldin);
+    }
+    return status;
+}
+
+int builtin_echo(char **argv)
+{
+    int i, newline = 1;
+
+    if (argv[1] != NULL && !strcmp(argv[1], "-n")) {
+        newline = 0;
+        argv++;
+    }
+    for (i = 1; argv[i] != NULL; i++) {
+        if (i > 1)
+            putchar(' ');
+        fputs(argv[i], stdout);
+    }
+    if (newline)
+        putchar('\n');
+    return 0;
+}
+
+int builtin_cd(char **argv)
+{
+    char *dir = argv[1], cwd[PATH_MAX];
+
+    if (dir == NULL && (dir = getenv("HOME")) == NULL) {
+        fprintf(stderr, "cd: HOME not set\n");
+        return 1;
+    }
+    if (chdir(dir) < 0) {
+        fprintf(stderr, "cd: %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+    if (getcwd(cwd, sizeof(cwd)) != NULL)
+        setenv("PWD", cwd, 1);
+    return 0;
+}
+
+int builtin_pwd(char **argv)
+{
+    char cwd[PATH_MAX];
+
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        fprintf(stderr, "pwd: %s\n", strerror(errno));
+        return 1;
+    }
+    puts(cwd);
+    return 0;
+}
+
+int builtin_export(char **argv)
+{
+    char **ep, *eq;
+    int i, status = 0;
+
+    if (argv[1] == NULL) {
+        for (ep = environ; *ep != NULL; ep++)
+            printf("export %s\n", *ep);
+        return 0;
+    }
+
+    /* There are no unexported variables: export name alone does nothing */
+    for (i = 1; argv[i] != NULL; i++) {
+        if ((eq = strchr(argv[i], '=')) == NULL)
+            continue;
+        *eq = '\0';
+        if (eq == argv[i] || setenv(argv[i], eq + 1, 1) < 0) {
+            fprintf(stderr, "export: '%s': not a valid identifier\n", argv[i]);
+            status = 1;
+        }
+        *eq = '=';
+    }
+    return status;
+}
+
+int builtin_true(char **argv)
+{
+    return 0;
+}
+
+int builtin_false(char **argv)
+{
+    return 1;
+}
+
+/*
+ * test(1), with POSIX's rules for up to four arguments. The helpers
+ * return 0 for true, 1 for false and 2 for a syntax error.
+ */
+static int test_expr(char **argv, int argc);
+
+static int test_not(int status)
+{
+    return status == 2 ? 2 : !status;
+}
+
+static int test_unary(char *op, char *arg)
+{
+    struct stat sb;
+
+    if (!strcmp(op, "-n"))
+        return *arg == '\0';
+    if (!strcmp(op, "-z"))
+        return *arg != '\0';
+    if (op[0] != '-' || op[1] == '\0' || op[2] != '\0')
+        return 2;
+
+    switch (op[1]) {
+        case 'r':
+            return access(arg, R_OK) != 0;
+        case 'w':
+            return access(arg, W_OK) != 0;
+        case 'x':
+            return access(arg, X_OK) != 0;
+        case 'e':
+        case 'f':
+        case 'd':
+        case 's':
+            if (stat(arg, &sb) < 0)
+                return 1;
+            if (op[1] == 'f')
+                return !S_ISREG(sb.st_mode);
+            if (op[1] == 'd')
+                return !S_ISDIR(sb.st_mode);
+            if (op[1] == 's')
+                return sb.st_size == 0;
+            return 0;
+    }
+    return 2;
+}
+
+static int test_binary(char *a, char *op, char *b)
+{
+    static char *ops[] = {"-eq", "-ne", "-lt", "-le", "-gt", "-ge"};
+    long x, y;
+    int i;
+
+    if (!strcmp(op, "="))
+        return strcmp(a, b) != 0;
+    if (!strcmp(op, "!="))
+        return strcmp(a, b) == 0;
+
+    for (i = 0; i < 6 && strcmp(op, ops[i]); i++)
+        ;
+    if (i == 6)
+        return 2;
+    x = strtol(a, NULL, 10);
+    y = strtol(b, NULL, 10);
+    switch (i) {
+        case 0:
+            return !(x == y);
+        case 1:
+            return !(x != y);
+        case 2:
+            return !(x < y);
+        case 3:
+            return !(x <= y);
+        case 4:
+            return !(x > y);
+        default:
+            return !(x >= y);
+    }
+}
+
+static int test_expr(char **argv, int argc)
+{
+    int status;
+
+    switch (argc) {
+        case 0:
+            return 1;
+        case 1:
+            return argv[0][0] == '\0';
+        case 2:
+            if (!strcmp(argv[0], "!"))
+                return test_not(test_expr(argv + 1, 1));
+            return test_unary(argv[0], argv[1]);
+        case 3:
+            if ((status = test_binary(argv[0], argv[1], argv[2])) != 2)
+                return status;
+            if (!strcmp(argv[0], "!"))
+                return test_not(test_expr(argv + 1, 2));
+            if (!strcmp(argv[0], "(") && !strcmp(argv[2], ")"))
+                return test_expr(argv + 1, 1);
+            return 2;
+        case 4:
+            if (!strcmp(argv[0], "!"))
+                return test_not(test_expr(argv + 1, 3));
+            if (!strcmp(argv[0], "(") && !strcmp(argv[3], ")"))
+                return test_expr(argv + 1, 2);
+    }
+    return 2;
+}
+
+int builtin_test(char **argv)
+{
+    int argc, status;
+
+    for (argc = 0; argv[argc] != NULL; argc++)
+        ;
+    if (!strcmp(argv[0], "[")) {
+        if (strcmp(argv[argc - 1], "]")) {
+            fprintf(stderr, "[: missing ']'\n");
+            return 2;
+        }
+        argc--;
+    }
+    if ((status = test_expr(argv + 1, argc - 1)) == 2)
+        fprintf(stderr, "%s: syntax error\n", argv[0]);
+    return status;
+}
+
+/**
+ * printf_escape - Prints the character of the backslash escape at @p.
+ *
+ * @return the last character of the escape.
+ */
+static char *printf_escape(char *p)
+{
+    static char from[] = "abfnrtv\\";
+    static char to[] = "\a\b\f\n\r\t\v\\";
+    char *c;
+    int i, v;
+
+    if (p[1] >= '0' && p[1] <= '7') {      /* \NNN, octal */
+        for (i = 0, v = 0; i < 3 && p[1] >= '0' && p[1] <= '7'; i++)
+            v = v * 8 + *++p - '0';
+        putchar(v);
+    }
+    else if (p[1] != '\0' && (c = strchr(from, p[1])) != NULL) {
+        putchar(to[c - from]);
+        p++;
+    }
+    else
+        putchar('\\');
+    return p;
+}
+
+int builtin_printf(char **argv)
+{
+    char spec[32], *fmt, *p, *arg, **args;
+    int n, used;
+
+    if ((fmt = argv[1]) == NULL) {
+        fprintf(stderr, "usage: printf format [arg ...]\n");
+        return 1;
+    }
+
+    /* The format is reused as long as it consumes arguments */
+    args = argv + 2;
+    do {
+        used = 0;
+        for (p = fmt; *p != '\0'; p++) {
+            if (*p == '\\') {
+                p = printf_escape(p);
+                continue;
+            }
+            if (*p != '%') {
+                putchar(*p);
+                continue;
+            }
+            if (p[1] == '%') {
+                putchar(*++p);
+                continue;
+            }
+
+            /* Copy %[flags][width][.precision] and insert an l for ints */
+            n = strspn(p + 1, "-+ #0123456789.") + 1;
+            if (n > (int)sizeof(spec) - 3 || p[n] == '\0' ||
+                strchr("diouxXcs", p[n]) == NULL) {
+                fprintf(stderr, "printf: invalid format '%s'\n", p);
+                return 1;
+            }
+            memcpy(spec, p, n);
+            arg = *args != NULL ? *args++ : "";
+            used = 1;
+            switch (p[n]) {
+                case 'd':
+                case 'i':
+                    sprintf(spec + n, "l%c", p[n]);
+                    printf(spec, strtol(arg, NULL, 0));
+                    break;
+                case 'o':
+                case 'u':
+                case 'x':
+                case 'X':
+                    sprintf(spec + n, "l%c", p[n]);
+                    printf(spec, strtoul(arg, NULL, 0));
+                    break;
+                case 'c':
+                    sprintf(spec + n, "c");
+                    printf(spec, arg[0]);
+                    break;
+                default:
+                    sprintf(spec + n, "s");
+                    printf(spec, arg);
+            }
+            p += n;
+        }
+    } while (used && *args != NULL);
+    return 0;
+}
+
+/* Signal names for kill, without the SIG prefix */
+static struct {
+    char *name;
+    int signum;
+} signames[] = {
+    {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"ILL", SIGILL},
+    {"ABRT", SIGABRT}, {"FPE", SIGFPE}, {"KILL", SIGKILL}, {"SEGV", SIGSEGV},
+    {"PIPE", SIGPIPE}, {"ALRM", SIGALRM}, {"TERM", SIGTERM},
+    {"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {"CHLD", SIGCHLD},
+    {"CONT", SIGCONT}, {"STOP", SIGSTOP}, {"TSTP", SIGTSTP},
+    {"TTIN", SIGTTIN}, {"TTOU", SIGTTOU}, {"WINCH", SIGWINCH}
+};
+#define NSIGNAMES (sizeof(signames) / sizeof(signames[0]))
+
+/**
+ * sig_parse - Returns the signal @name stands for: a name of signames,
+ * RTMIN+n, RTMAX-n or a number, all but numbers with or without SIG.
+ * Returns -1 if none.
+ */
+static int sig_parse(char *name)
+{
+    char *end;
+    long n = 0;
+    int i;
+
+    if (!strncmp(name, "SIG", 3))
+        name += 3;
+    for (i = 0; i < NSIGNAMES; i++)
+        if (!strcmp(name, signames[i].name))
+            return signames[i].signum;
+
+    if (!strncmp(name, "RTMIN", 5) || !strncmp(name, "RTMAX", 5)) {
+        if (name[5] != '\0') {
+            if (name[5] != (name[4] == 'N' ? '+' : '-') || !isdigit(name[6]))
+                return -1;
+            n = strtol(name + 6, &end, 10);
+            if (*end != '\0' || n > SIGRTMAX - SIGRTMIN)
+                return -1;
+        }
+        return name[4] == 'N' ? SIGRTMIN + n : SIGRTMAX - n;
+    }
+
+    n = strtol(name, &end, 10);
+    if (end == name || *end != '\0' || n < 0 || n > SIGRTMAX)
+        return -1;
+    return n;
+}
+
+char **kill_signal(char **argv, int *sigp, char **queuep)
+{
+    char *name;
+    int sig = -1;
+
+    *sigp = SIGTERM;
+    *queuep = NULL;
+    for (argv++; *argv != NULL && (*argv)[0] == '-' && strcmp(*argv, "--");
+         argv++) {
+        if (!strcmp(*argv, "-q")) {
+            if ((*queuep = *++argv) == NULL) {
+                fprintf(stderr, "kill: -q requires a value\n");
+                return NULL;
+            }
+            continue;
+        }
+
+        /* After the signal, -n is a process group */
+        if (sig >= 0)
+            break;
+        name = *argv + 1;
+        if (!strcmp(*argv, "-s") && (name = *++argv) == NULL) {
+            fprintf(stderr, "kill: -s requires a signal\n");
+            return NULL;
+        }
+        if ((sig = sig_parse(name)) < 0) {
+            fprintf(stderr, "kill: %s: invalid signal\n", name);
+            return NULL;
+        }
+        *sigp = sig;
+    }
+    if (*argv != NULL && !strcmp(*argv, "--"))
+        argv++;
+    if (*argv == NULL) {
+        fprintf(stderr, "usage: kill [-s sig | -sig] [-q value] pid ...\n");
+        return NULL;
+    }
+    return argv;
+}
+
+int kill_send(pid_t pid, int signum, char *queue)
+{
+    union sigval value;
+
+    if (queue == NULL)
+        return kill(pid, signum);
+    value.sival_int = atoi(queue);
+    return sigqueue(pid, signum, value);
+}
+
+int builtin_kill(char **argv)
+{
+    int signum, status = 0;
+    char *queue;
+
+    if ((argv = kill_signal(argv, &signum, &queue)) == NULL)
+        return 1;
+    for (; *argv != NULL; argv++) {
+        if (kill_send(atoi(*argv), signum, queue) < 0) {
+            fprintf(stderr, "kill: (%s): %s\n", *argv, strerror(errno));
+            status = 1;
+        }
+    }
+    return status;
+}
+
+/*****************************************************************************************
+ * Resource accounting.
+ * ***************************************************************************************/
+static FILE *acct_fp;           /* Accounting log, or NULL */
+
+double clock_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* tv_add - Adds @b to @a, or subtracts it if @sign is -1 */
+static void tv_add(struct timeval *a, const struct timeval *b, int sign)
+{
+    a->tv_sec += sign * b->tv_sec;
+    a->tv_usec += sign * b->tv_usec;
+    if (a->tv_usec >= 1000000) {
+        a->tv_sec++;
+        a->tv_usec -= 1000000;
+    }
+    else if (a->tv_usec < 0) {
+        a->tv_sec--;
+        a->tv_usec += 1000000;
+    }
+}
+
+void rusage_add(struct rusage *sum, const struct rusage *ru)
+{
+    tv_add(&sum->ru_utime, &ru->ru_utime, 1);
+    tv_add(&sum->ru_stime, &ru->ru_stime, 1);
+    if (ru->ru_maxrss > sum->ru_maxrss)
+        sum->ru_maxrss = ru->ru_maxrss;
+    sum->ru_minflt += ru->ru_minflt;
+    sum->ru_majflt += ru->ru_majflt;
+    sum->ru_nvcsw += ru->ru_nvcsw;
+    sum->ru_nivcsw += ru->ru_nivcsw;
+}
+
+void rusage_sub(struct rusage *ru, const struct rusage *start)
+{
+    tv_add(&ru->ru_utime, &start->ru_utime, -1);
+    tv_add(&ru->ru_stime, &start->ru_stime, -1);
+    ru->ru_minflt -= start->ru_minflt;
+    ru->ru_majflt -= start->ru_majflt;
+    ru->ru_nvcsw -= start->ru_nvcsw;
+    ru->ru_nivcsw -= start->ru_nivcsw;
+}
+
+#define TV_SEC(tv) ((tv).tv_sec + (tv).tv_usec / 1e6)
+
+void rusage_print(FILE *fp, double real, const struct rusage *ru)
+{
+    fprintf(fp, "real %.3fs  user %.3fs  sys %.3fs\n", real,
+            TV_SEC(ru->ru_utime), TV_SEC(ru->ru_stime));
+    fprintf(fp, "maxrss %ld KB  faults %ld minor %ld major  "
+            "switches %ld voluntary %ld involuntary\n", ru->ru_maxrss,
+            ru->ru_minflt, ru->ru_majflt, ru->ru_nvcsw, ru->ru_nivcsw);
+}
+
+void acct_open(char *path)
+{
+    /* O_APPEND: each line is one write, never interleaved with others */
+    if ((acct_fp = fopen(path, "a")) == NULL)
+        unix_error("acct_open error");
+    setvbuf(acct_fp, NULL, _IOLBF, 0);
+}
+
+void acct_log(char *cmd, int status, double real, const struct rusage *ru)
+{
+    struct timespec ts;
+
+    if (acct_fp == NULL)
+        return;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    status = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+    fprintf(acct_fp, "end=%ld.%03ld real=%.6f user=%.6f sys=%.6f maxrss=%ld "
+            "minflt=%ld majflt=%ld nvcsw=%ld nivcsw=%ld status=%d cmd=%.*s\n",
+            (long)ts.tv_sec, ts.tv_nsec / 1000000, real, TV_SEC(ru->ru_utime),
+            TV_SEC(ru->ru_stime), ru->ru_maxrss, ru->ru_minflt, ru->ru_majflt,
+            ru->ru_nvcsw, ru->ru_nivcsw, status, (int)strcspn(cmd, "\n"), cmd);
+}
+
+/*****************************************************************************************
+ * Performance counters.
+ * ***************************************************************************************/
+#define PERF_REGIONS (64)
+
+enum { PERF_CLOSED, PERF_HW, PERF_SW, PERF_RUSAGE };
+
+/* A counter perf_event_open can open */
+typedef struct {
+    char *name;
+    unsigned type;
+    unsigned long long config;
+} perf_event_t;
+
+/* Read misses of a cache */
+#define PERF_MISSES(cache) ((cache) | PERF_COUNT_HW_CACHE_OP_READ << 8 \
+                            | PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+
+/* The group of each mode, led by the first counter */
+static perf_event_t perf_hw[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"L1d-misses", PERF_TYPE_HW_CACHE, PERF_MISSES(PERF_COUNT_HW_CACHE_L1D)},
+    {"LLC-misses", PERF_TYPE_HW_CACHE, PERF_MISSES(PERF_COUNT_HW_CACHE_LL)},
+    {"dTLB-misses", PERF_TYPE_HW_CACHE, PERF_MISSES(PERF_COUNT_HW_CACHE_DTLB)},
+    {"page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+};
+static perf_event_t perf_sw[] = {
+    {"task-clock-ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+    {"page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+    {"ctx-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+    {"migrations", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS},
+};
+static char *perf_ru[] = {"user-us", "sys-us", "page-faults", "ctx-switches"};
+
+static int perf_mode;                   /* PERF_CLOSED until perf_open */
+static int perf_fd = -1;                /* Group leader */
+static int perf_n;                      /* Counters in the group */
+static char *perf_names[PERF_MAX];
+static int perf_kernel;                 /* Kernel space counted too? */
+static int perf_children;               /* Children counted too? */
+static perf_region_t perf_regions[PERF_REGIONS];
+static int perf_nregions;
+
+/* perf_event - Opens counter @e in group @group, or as a leader if -1 */
+static int perf_event(perf_event_t *e, int group)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = e->type;
+    attr.config = e->config;
+    attr.inherit = perf_children;
+    attr.exclude_kernel = !perf_kernel;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+        | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group,
+                   PERF_FLAG_FD_CLOEXEC);
+}
+
+/**
+ * perf_group - Opens the @n counters @events as a group, without the ones
+ * the CPU does not have, and kernel space only if allowed.
+ *
+ * @return 0, or -1 if the leader cannot be opened.
+ */
+static int perf_group(perf_event_t *events, int n)
+{
+    int i;
+
+    perf_kernel = 1;
+    if ((perf_fd = perf_event(&events[0], -1)) < 0
+        && (errno == EACCES || errno == EPERM)) {
+        perf_kernel = 0;
+        perf_fd = perf_event(&events[0], -1);
+    }
+    if (perf_fd < 0)
+        return -1;
+
+    /* The fds of the others stay open: closing one leaves the group */
+    perf_names[0] = events[0].name;
+    perf_n = 1;
+    for (i = 1; i < n; i++)
+        if (perf_event(&events[i], perf_fd) >= 0)
+            perf_names[perf_n++] = events[i].name;
+    return 0;
+}
+
+int perf_open(int children)
+{
+    if (perf_mode != PERF_CLOSED)
+        return perf_n;
+    perf_children = children;
+    if (perf_group(perf_hw, sizeof(perf_hw) / sizeof(perf_hw[0])) == 0)
+        perf_mode = PERF_HW;
+    else if (perf_group(perf_sw, sizeof(perf_sw) / sizeof(perf_sw[0])) == 0)
+        perf_mode = PERF_SW;
+    else {
+        perf_mode = PERF_RUSAGE;
+        perf_kernel = 1;
+        perf_n = sizeof(perf_ru) / sizeof(perf_ru[0]);
+        memcpy(perf_names, perf_ru, sizeof(perf_ru));
+    }
+    return perf_n;
+}
+
+char *perf_name(int i)
+{
+    perf_open(1);
+    return i >= 0 && i < perf_n ? perf_names[i] : NULL;
+}
+
+void perf_read(double *counts)
+{
+    unsigned long long buf[3 + PERF_MAX];   /* nr, enabled, running, values */
+    struct rusage ru, kids;
+    double scale;
+    int i;
+
+    perf_open(1);
+    if (perf_mode == PERF_RUSAGE) {
+        getrusage(RUSAGE_SELF, &ru);
+        if (perf_children) {
+            getrusage(RUSAGE_CHILDREN, &kids);
+            rusage_add(&ru, &kids);
+        }
+        counts[0] = TV_SEC(ru.ru_utime) * 1e6;
+        counts[1] = TV_SEC(ru.ru_stime) * 1e6;
+        counts[2] = ru.ru_minflt + ru.ru_majflt;
+        counts[3] = ru.ru_nvcsw + ru.ru_nivcsw;
+        return;
+    }
+    if (read(perf_fd, buf, sizeof(buf)) < 0)
+        unix_error("perf_read error");
+    scale = buf[2] ? (double)buf[1] / buf[2] : 0;
+    for (i = 0; i < perf_n; i++)
+        counts[i] = buf[3 + i] * scale;
+}
+
+perf_region_t *perf_region(char *name)
+{
+    int i;
+
+    for (i = 0; i < perf_nregions; i++)
+        if (perf_regions[i].name == name || !strcmp(perf_regions[i].name, name))
+            return &perf_regions[i];
+    if (perf_nregions == PERF_REGIONS)
+        app_error("perf_region: too many regions");
+    perf_regions[perf_nregions].name = name;
+    return &perf_regions[perf_nregions++];
+}
+
+void perf_begin(perf_region_t *r)
+{
+    r->start_time = clock_now();
+    perf_read(r->start);
+}
+
+void perf_end(perf_region_t *r)
+{
+    double counts[PERF_MAX];
+    int i;
+
+    perf_read(counts);
+    r->time += clock_now() - r->start_time;
+    for (i = 0; i < perf_n; i++)
+        r->counts[i] += counts[i] - r->start[i];
+    r->calls++;
+}
+
+void perf_report(FILE *fp)
+{
+    static char *modes[] = {"no", "hardware", "software", "rusage"};
+    perf_region_t *r;
+    int i, ipc;
+
+    if (perf_nregions == 0)
+        return;
+    ipc = perf_mode == PERF_HW && perf_n > 1
+        && !strcmp(perf_names[1], "instructions");
+    fprintf(fp, "perf: %s counters, %s space%s\n", modes[perf_mode],
+            perf_kernel ? "user and kernel" : "user",
+            perf_children ? ", children included" : "");
+    fprintf(fp, "%-16s %7s %10s", "region", "calls", "seconds");
+    for (i = 0; i < perf_n; i++)
+        fprintf(fp, " %13s", perf_names[i]);
+    fprintf(fp, "%s\n", ipc ? "    IPC" : "");
+    for (r = perf_regions; r < perf_regions + perf_nregions; r++) {
+        fprintf(fp, "%-16s %7ld %10.3f", r->name, r->calls, r->time);
+        for (i = 0; i < perf_n; i++)
+            fprintf(fp, " %13.0f", r->counts[i]);
+        if (ipc)
+            fprintf(fp, " %6.2f", r->counts[0] ? r->counts[1] / r->counts[0] : 0);
+        fprintf(fp, "\n");
+    }
+}
+
+/*****************************************************************************************
+ * Command history.
+ * ***************************************************************************************/
+#define HIST_MAGIC "cshist1"            /* 8 bytes with its NUL */
+#define HIST_LEVELS (5)                 /* Prefixes of 1, 2, 4, 8, 16 bytes */
+#define HIST_NHEADS (1 << 16)           /* Buckets per prefix length */
+#define HIST_BLOCK (128)                 /* Records per index record */
+#define HIST_MAXSIZE (1UL << 32)        /* Address space kept for the file */
+#define HIST_CHUNK (1 << 20)            /* The file grows at least this much */
+#define HIST_LIST (16)                  /* Entries history prints by default */
+
+/* The file starts with this header */
+typedef struct {
+    char magic[8];
+    uint64_t end;                       /* Offset past the last record */
+    uint64_t index;                     /* Last index record, or 0 */
+    uint64_t unindexed;                 /* Records after it */
+    uint64_t heads[HIST_LEVELS][HIST_NHEADS];   /* Last record of each
+                                                   bucket, or 0 */
+} hist_header_t;
+
+/* Then come the records, 8-byte aligned */
+typedef struct {
+    uint64_t prev[HIST_LEVELS]; /* Previous record of the same buckets */
+    uint32_t len;           /* Length of cmd */
+    char cmd[];             /* The command line, NUL-terminated */
+} hist_rec_t;
+
+/**
+ * After every HIST_BLOCK records comes an index record with their
+ * signatures, so that a substring search reads them packed together
+ * instead of chasing one record after another.
+ */
+typedef struct {
+    uint64_t prev;                  /* Previous index record, or 0 */
+    uint64_t sigs[HIST_BLOCK];      /* Signatures of the records */
+    uint64_t recs[HIST_BLOCK];      /* and their offsets, oldest first */
+} hist_index_t;
+
+/* Both end with this, for walking them backwards */
+typedef struct {
+    uint64_t sig;           /* One bit per trigram of cmd */
+    uint32_t size;          /* Size of the record */
+    uint32_t index;         /* Is it an index record? */
+} hist_tail_t;
+
+#define HIST_SIZE(len) (((offsetof(hist_rec_t, cmd) + (len) + 1 + 7) & ~7UL) \
+                        + sizeof(hist_tail_t))
+#define HIST_ISIZE (sizeof(hist_index_t) + sizeof(hist_tail_t))
+#define HIST_REC(off) ((hist_rec_t *)((char *)hist + (off)))
+#define HIST_INDEX(off) ((hist_index_t *)((char *)hist + (off)))
+#define HIST_TAIL(end) ((hist_tail_t *)((char *)hist + (end)) - 1)
+#define HIST_FIRST (sizeof(hist_header_t))
+
+static hist_header_t *hist;     /* The mapped file, or NULL */
+static int hist_fd;
+static uint64_t hist_size;      /* Size of the file, as last seen */
+
+/**
+ * hist_bucket - Returns the bucket of the first 1 << @level bytes of @s at
+ * that level. One or two bytes are the bucket number, longer prefixes are
+ * hashed.
+ */
+static int hist_bucket(const char *s, int level)
+{
+    const unsigned char *p = (const unsigned char *)s;
+    uint64_t h = 14695981039346656037UL;    /* FNV-1a */
+    int i;
+
+    if (level == 0)
+        return p[0];
+    if (level == 1)
+        return p[0] << 8 | p[1];
+    for (i = 0; i < 1 << level; i++)
+        h = (h ^ p[i]) * 1099511628211UL;
+    return (h ^ h >> 16 ^ h >> 32 ^ h >> 48) & (HIST_NHEADS - 1);
+}
+
+/**
+ * hist_sig - Returns the trigrams of the @n bytes at @s hashed into 64
+ * bits. An entry contains a string only if its signature has every bit of
+ * the string's, which rules most entries out without reading their text.
+ */
+static uint64_t hist_sig(const char *s, size_t n)
+{
+    const unsigned char *p = (const unsigned char *)s;
+    uint64_t sig = 0;
+    uint32_t h;
+    size_t i;
+
+    for (i = 0; i + 2 < n; i++) {
+        h = (uint32_t)(p[i] << 16 | p[i + 1] << 8 | p[i + 2]) * 2654435761U;
+        sig |= 1UL << (h >> 26);
+    }
+    return sig;
+}
+
+/**
+ * hist_grow - Makes the locked file at least @end bytes long, growing it
+ * by an eighth at least. Returns -1 if the file is full or cannot grow.
+ */
+static int hist_grow(uint64_t end)
+{
+    struct stat st;
+    uint64_t grow;
+
+    if (end <= hist_size)
+        return 0;
+
+    /* Another shell may have grown it already */
+    if (fstat(hist_fd, &st) < 0)
+        return -1;
+    if ((hist_size = st.st_size) >= end)
+        return 0;
+    if (end > HIST_MAXSIZE) {
+        errno = EFBIG;
+        return -1;
+    }
+    grow = hist_size / 8 > HIST_CHUNK ? hist_size / 8 : HIST_CHUNK;
+    if (end + grow > HIST_MAXSIZE)
+        grow = HIST_MAXSIZE - end;
+    if ((errno = posix_fallocate(hist_fd, 0, end + grow)) != 0)
+        return -1;
+    hist_size = end + grow;
+    return 0;
+}
+
+/* hist_init - Checks the header of the locked file, or writes a new one */
+static int hist_init(void)
+{
+    hist_size = 0;
+    if (hist_grow(HIST_FIRST) < 0)
+        return -1;
+    if (hist->end == 0) {
+        memcpy(hist->magic, HIST_MAGIC, sizeof(hist->magic));
+        hist->end = HIST_FIRST;
+    }
+    else if (memcmp(hist->magic, HIST_MAGIC, sizeof(hist->magic))) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+int hist_open(char *path)
+{
+    char buf[PATH_MAX];
+    void *base;
+    int rc, olderrno;
+
+    if (path == NULL && (path = getenv("HISTFILE")) == NULL) {
+        snprintf(buf, sizeof(buf), "%s/.csapp_history",
+                 getenv("HOME") ? getenv("HOME") : ".");
+        path = buf;
+    }
+    if ((hist_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) < 0)
+        return -1;
+
+    /* Map room to grow into once, only what the file holds is ever touched */
+    base = mmap(NULL, HIST_MAXSIZE, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_NORESERVE, hist_fd, 0);
+    if (base == MAP_FAILED) {
+        olderrno = errno;
+        close(hist_fd);
+        errno = olderrno;
+        return -1;
+    }
+    hist = base;
+
+    /* Two shells creating the file at once must not both write a header */
+    if ((rc = flock(hist_fd, LOCK_EX)) == 0) {
+        rc = hist_init();
+        olderrno = errno;
+        flock(hist_fd, LOCK_UN);
+        errno = olderrno;
+    }
+    if (rc < 0) {
+        olderrno = errno;
+        hist_close();
+        errno = olderrno;
+    }
+    return rc;
+}
+
+void hist_close(void)
+{
+    if (hist == NULL)
+        return;
+    munmap(hist, HIST_MAXSIZE);
+    close(hist_fd);
+    hist = NULL;
+}
+
+/* hist_before - Returns the command record before offset @end, or 0 */
+static uint64_t hist_before(uint64_t end)
+{
+    hist_tail_t *tail;
+
+    while (end > HIST_FIRST) {
+        tail = HIST_TAIL(end);
+        end -= tail->size;
+        if (!tail->index)
+            return end;
+    }
+    return 0;
+}
+
+/* hist_limit - Returns where a search older than entry @from starts */
+static uint64_t hist_limit(char *from)
+{
+    if (from == NULL)
+        return __atomic_load_n(&hist->end, __ATOMIC_ACQUIRE);
+    return from - offsetof(hist_rec_t, cmd) - (char *)hist;
+}
+
+/* hist_index - Writes at @end the index of the HIST_BLOCK records before */
+static void hist_index(uint64_t end)
+{
+    hist_index_t *ix = HIST_INDEX(end);
+    hist_tail_t *tail;
+    uint64_t off = end;
+    int i;
+
+    for (i = HIST_BLOCK - 1; i >= 0; i--) {
+        tail = HIST_TAIL(off);
+        off -= tail->size;
+        ix->sigs[i] = tail->sig;
+        ix->recs[i] = off;
+    }
+    ix->prev = hist->index;
+    tail = HIST_TAIL(end + HIST_ISIZE);
+    tail->sig = 0;
+    tail->size = HIST_ISIZE;
+    tail->index = 1;
+    hist->index = end;
+    hist->unindexed = 0;
+}
+
+void hist_add(char *cmd)
+{
+    size_t len = strcspn(cmd, "\n");
+    uint64_t end, size, last;
+    hist_rec_t *rec;
+    hist_tail_t *tail;
+    int i, b;
+
+    if (hist == NULL || len == 0 || flock(hist_fd, LOCK_EX) < 0)
+        return;
+    end = hist->end;
+    size = HIST_SIZE(len);
+
+    /* Repeats of the last command are kept once */
+    last = hist_before(end);
+    if (last && HIST_REC(last)->len == len
+        && !memcmp(HIST_REC(last)->cmd, cmd, len)) {
+        flock(hist_fd, LOCK_UN);
+        return;
+    }
+
+    /* Room for the record, and for the index it may complete */
+    if (hist_grow(end + size + (hist->unindexed + 1 == HIST_BLOCK
+                                ? HIST_ISIZE : 0)) < 0) {
+        flock(hist_fd, LOCK_UN);
+        return;
+    }
+
+    rec = HIST_REC(end);
+    rec->len = len;
+    memcpy(rec->cmd, cmd, len);
+    rec->cmd[len] = '\0';
+    tail = HIST_TAIL(end + size);
+    tail->sig = hist_sig(cmd, len);
+    tail->size = size;
+    tail->index = 0;
+
+    /* Publish the complete record: in its buckets, then to everybody.
+       Readers skip bucket entries past the end they read */
+    for (i = 0; i < HIST_LEVELS && 1 << i <= len; i++) {
+        b = hist_bucket(rec->cmd, i);
+        rec->prev[i] = hist->heads[i][b];
+        __atomic_store_n(&hist->heads[i][b], end, __ATOMIC_RELEASE);
+    }
+    end += size;
+    if (++hist->unindexed == HIST_BLOCK) {
+        hist_index(end);
+        end += HIST_ISIZE;
+    }
+    __atomic_store_n(&hist->end, end, __ATOMIC_RELEASE);
+    flock(hist_fd, LOCK_UN);
+}
+
+char *hist_prev(char *from)
+{
+    uint64_t off;
+
+    if (hist == NULL || (off = hist_before(hist_limit(from))) == 0)
+        return NULL;
+    return HIST_REC(off)->cmd;
+}
+
+char *hist_prefix(char *prefix, char *from)
+{
+    size_t n = strlen(prefix);
+    uint64_t limit, off;
+    int level;
+
+    if (hist == NULL || n == 0)
+        return hist_prev(from);
+    limit = hist_limit(from);
+
+    /* Walk the bucket of the longest indexed prefix of @prefix, from
+       @from on if it is a match: it is in that bucket */
+    for (level = 0; level + 1 < HIST_LEVELS && 1 << (level + 1) <= n; level++)
+        ;
+    if (from != NULL && !strncmp(from, prefix, n))
+        off = HIST_REC(limit)->prev[level];
+    else
+        off = __atomic_load_n(&hist->heads[level][hist_bucket(prefix, level)],
+                              __ATOMIC_ACQUIRE);
+    for (; off > 0; off = HIST_REC(off)->prev[level])
+        if (off < limit && !strncmp(HIST_REC(off)->cmd, prefix, n))
+            return HIST_REC(off)->cmd;
+    return NULL;
+}
+
+/* hist_match - Does the record at @off, of signature @rsig, contain @str? */
+static int hist_match(uint64_t off, uint64_t rsig, char *str, size_t n,
+                      uint64_t sig)
+{
+    return (rsig & sig) == sig
+        && memmem(HIST_REC(off)->cmd, HIST_REC(off)->len, str, n) != NULL;
+}
+
+char *hist_substr(char *str, char *from)
+{
+    size_t n = strlen(str);
+    uint64_t end, off, sig = hist_sig(str, n);
+    hist_index_t *ix;
+    hist_tail_t *tail = NULL;
+    int i;
+
+    if (hist == NULL)
+        return NULL;
+
+    /* One at a time back to an index record */
+    for (end = hist_limit(from); end > HIST_FIRST; end = off) {
+        tail = HIST_TAIL(end);
+        off = end - tail->size;
+        if (tail->index)
+            break;
+        if (hist_match(off, tail->sig, str, n, sig))
+            return HIST_REC(off)->cmd;
+    }
+
+    /* Then a block at a time, the next one on its way into the cache */
+    off = end > HIST_FIRST ? end - tail->size : 0;
+    for (; off > 0; off = ix->prev) {
+        ix = HIST_INDEX(off);
+        if (ix->prev)
+            for (i = 0; i < sizeof(ix->sigs); i += 64)
+                __builtin_prefetch((char *)HIST_INDEX(ix->prev)->sigs + i);
+        for (i = HIST_BLOCK - 1; i >= 0; i--)
+            if (hist_match(ix->recs[i], ix->sigs[i], str, n, sig))
+                return HIST_REC(ix->recs[i])->cmd;
+    }
+    return NULL;
+}
+
+int hist_expand(char *line, int maxlen)
+{
+    char *end, *entry, save;
+    size_t len, rest;
+
+    if (line[0] != '!' || strchr(" \t\n=(", line[1]) != NULL)
+        return 0;
+
+    /* The reference is the first word */
+    end = line + strcspn(line, " \t\n");
+    save = *end;
+    *end = '\0';
+    if (!strcmp(line, "!!"))
+        entry = hist_prev(NULL);
+    else if (line[1] == '?') {
+        if (end[-1] == '?' && end - line > 2)
+            end[-1] = '\0';
+        entry = hist_substr(line + 2, NULL);
+    }
+    else
+        entry = hist_prefix(line + 1, NULL);
+    if (entry == NULL) {
+        fprintf(stderr, "%s: event not found\n", line);
+        return -1;
+    }
+    *end = save;
+
+    len = strlen(entry);
+    rest = strlen(end) + 1;
+    if (len + rest > maxlen) {
+        fprintf(stderr, "history: expanded line too long\n");
+        return -1;
+    }
+    memmove(line + len, end, rest);
+    memcpy(line, entry, len);
+    return 1;
+}
+
+int builtin_history(char **argv)
+{
+    char *(*find)(char *, char *) = NULL;
+    char *key = NULL, *e, **last;
+    int i, n = HIST_LIST;
+
+    argv++;
+    if (*argv != NULL && (!strcmp(*argv, "-p") || !strcmp(*argv, "-s"))) {
+        find = argv[0][1] == 'p' ? hist_prefix : hist_substr;
+        if ((key = argv[1]) == NULL)
+            argv = NULL;
+        else
+            argv += 2;
+    }
+    if (argv != NULL && *argv != NULL && ((n = atoi(*argv)) <= 0 || argv[1]))
+        argv = NULL;
+    if (argv == NULL) {
+        fprintf(stderr, "usage: history [-p prefix | -s string] [n]\n");
+        return 2;
+    }
+    if (hist == NULL) {
+        fprintf(stderr, "history: no history file\n");
+        return 1;
+    }
+
+    if (find != NULL) {
+        for (e = NULL, i = 0; i < n && (e = find(key, e)) != NULL; i++)
+            printf("%s\n", e);
+        return 0;
+    }
+
+    /* Back n entries, then print them forward */
+    last = Malloc(n * sizeof(char *));
+    for (e = NULL, i = 0; i < n && (e = hist_prev(e)) != NULL; i++)
+        last[i] = e;
+    while (i-- > 0)
+        printf("%s\n", last[i]);
+    Free(last);
+    return 0;
+}
+
+
+/*****************************************************************************************
+ * Wrappers for memory mapping functions.
+ * ***************************************************************************************/
+void *Mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset)
+{
+    void *p;
+    if ((p = mmap(addr, len, prot, flags, fd, offset)) == MAP_FAILED)
+        unix_error("Mmap error");
+    return p;
+}
+
+void Munmap(void *start, size_t length)
+{
+    if (munmap(start, length) < 0)
+        unix_error("Munmap error");
+}
+
+/*****************************************************************************************
+ * Shared memory.
+ * ***************************************************************************************/
+#define SHM_LINE (64)           /* Cache line size */
+#define SHM_SPIN (4096)         /* Tries before a ring waiter sleeps */
+#define SHM_PAGE (4096)
+
+struct shm {
+    size_t size;                /* Of the whole region */
+    size_t used;                /* Allocated so far, this header included */
+};
+
+struct spsc {
+    unsigned long head;         /* Next position to write */
+    unsigned long tail_seen;    /* The producer's last look at tail */
+    char pad1[SHM_LINE - 2 * sizeof(unsigned long)];
+    unsigned long tail;         /* Next position to read */
+    unsigned long head_seen;    /* The consumer's last look at head */
+    char pad2[SHM_LINE - 2 * sizeof(unsigned long)];
+    int seq;                    /* Futex word, bumped for a sleeping peer */
+    int waiting;                /* Is the peer about to sleep on seq? */
+    int spin;                   /* Tries before sleeping */
+    unsigned long mask;         /* Ring size - 1 */
+    size_t size;                /* Of a message */
+    char pad3[SHM_LINE - 3 * sizeof(int) - sizeof(unsigned long)
+              - sizeof(size_t)];
+    char msgs[];
+};
+
+/* cpu_relax - Tells the CPU we are spinning */
+static void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+shm_t *shm_create(size_t size)
+{
+    shm_t *shm;
+
+    size = (size + SHM_LINE + SHM_PAGE - 1) & ~(size_t)(SHM_PAGE - 1);
+    shm = Mmap(NULL, size, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    shm->size = size;
+    shm->used = SHM_LINE;
+    return shm;
+}
+
+void *shm_alloc(shm_t *shm, size_t size)
+{
+    size_t used, end;
+
+    size = (size + SHM_LINE - 1) & ~(size_t)(SHM_LINE - 1);
+    used = __atomic_load_n(&shm->used, __ATOMIC_RELAXED);
+    do {
+        if ((end = used + size) > shm->size)
+            return NULL;
+    } while (!__atomic_compare_exchange_n(&shm->used, &used, end, 1,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return (char *)shm + used;
+}
+
+void shm_destroy(shm_t *shm)
+{
+    Munmap(shm, shm->size);
+}
+
+int futex_wait(int *uaddr, int val, int timeout)
+{
+    struct timespec ts, *tsp = NULL;
+
+    if (timeout >= 0) {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000L;
+        tsp = &ts;
+    }
+    if (syscall(SYS_futex, uaddr, FUTEX_WAIT, val, tsp, NULL, 0) < 0) {
+        if (errno == ETIMEDOUT)
+            return -1;
+        if (errno != EAGAIN && errno != EINTR)
+            unix_error("futex_wait error");
+    }
+    return 0;
+}
+
+void futex_wake(int *uaddr, int n)
+{
+    if (syscall(SYS_futex, uaddr, FUTEX_WAKE, n, NULL, NULL, 0) < 0)
+        unix_error("futex_wake error");
+}
+
+/*
+ * A waker changes the state, then reads the waiting flag; a waiter sets
+ * the flag, then reads the state again, all sequentially consistent: one
+ * of them sees what the other did. If the waker sees the flag, it clears
+ * it and bumps the futex word, so the waiter either does not go to sleep
+ * or is woken up. Clearing the flag saves the next changes a system call
+ * while the waiter is not running yet.
+ */
+static void futex_notify(int *seq, int *waiting)
+{
+    if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST)
+        && __atomic_exchange_n(waiting, 0, __ATOMIC_SEQ_CST)) {
+        __atomic_add_fetch(seq, 1, __ATOMIC_SEQ_CST);
+        futex_wake(seq, INT_MAX);
+    }
+}
+
+long counter_add(counter_t *c, long n)
+{
+    long value = __atomic_add_fetch(&c->value, n, __ATOMIC_SEQ_CST);
+
+    futex_notify(&c->seq, &c->waiting);
+    return value;
+}
+
+long counter_get(counter_t *c)
+{
+    return __atomic_load_n(&c->value, __ATOMIC_SEQ_CST);
+}
+
+long counter_wait(counter_t *c, long old, int timeout)
+{
+    long value;
+    int seq;
+
+    while (1) {
+        seq = __atomic_load_n(&c->seq, __ATOMIC_SEQ_CST);
+        if ((value = counter_get(c)) != old)
+            return value;
+        __atomic_store_n(&c->waiting, 1, __ATOMIC_SEQ_CST);
+        if ((value = counter_get(c)) != old)
+            return value;
+        if (futex_wait(&c->seq, seq, timeout) < 0)
+            return counter_get(c);
+    }
+}
+
+spsc_t *spsc_create(shm_t *shm, unsigned long n, size_t size)
+{
+    spsc_t *q;
+
+    if (n == 0 || (n & (n - 1)) != 0)
+        app_error("spsc_create error: size not a power of 2");
+    if ((q = shm_alloc(shm, sizeof(spsc_t) + n * size)) == NULL)
+        return NULL;
+    q->mask = n - 1;
+    q->size = size;
+
+    /* Spinning only helps if the peer can run meanwhile */
+    q->spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SHM_SPIN : 0;
+    return q;
+}
+
+/*
+ * Each side owns its index and keeps its last look at the other one, so
+ * it only reads the other side's cache line when the ring seems full
+ * (or empty).
+ */
+int spsc_push(spsc_t *q, const void *msg)
+{
+    unsigned long head = q->head;
+
+    if (head - q->tail_seen > q->mask) {
+        q->tail_seen = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+        if (head - q->tail_seen > q->mask)
+            return 0;
+    }
+    memcpy(q->msgs + (head & q->mask) * q->size, msg, q->size);
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_SEQ_CST);
+    futex_notify(&q->seq, &q->waiting);
+    return 1;
+}
+
+int spsc_pop(spsc_t *q, void *msg)
+{
+    unsigned long tail = q->tail;
+
+    if (tail == q->head_seen) {
+        q->head_seen = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+        if (tail == q->head_seen)
+            return 0;
+    }
+    memcpy(msg, q->msgs + (tail & q->mask) * q->size, q->size);
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_SEQ_CST);
+    futex_notify(&q->seq, &q->waiting);
+    return 1;
+}
+
+/* spsc_try - Pushes @msg into @q if @push, else pops it */
+static int spsc_try(spsc_t *q, void *msg, int push)
+{
+    return push ? spsc_push(q, msg) : spsc_pop(q, msg);
+}
+
+/* spsc_wait - spsc_push_wait if @push, else spsc_pop_wait */
+static int spsc_wait(spsc_t *q, void *msg, int push, int timeout)
+{
+    int i, seq;
+
+    for (i = 0; i < q->spin; i++) {
+        if (spsc_try(q, msg, push))
+            return 1;
+        cpu_relax();
+    }
+    while (1) {
+        seq = __atomic_load_n(&q->seq, __ATOMIC_SEQ_CST);
+        if (spsc_try(q, msg, push))
+            return 1;
+        __atomic_store_n(&q->waiting, 1, __ATOMIC_SEQ_CST);
+        if (spsc_try(q, msg, push))
+            return 1;
+        if (futex_wait(&q->seq, seq, timeout) < 0)
+            return spsc_try(q, msg, push);
+    }
+}
+
+int spsc_push_wait(spsc_t *q, const void *msg, int timeout)
+{
+    return spsc_wait(q, (void *)msg, 1, timeout);
+}
+
+int spsc_pop_wait(spsc_t *q, void *msg, int timeout)
+{
+    return spsc_wait(q, msg, 0, timeout);
+}
+
+
+/*****************************************************************************************
+ * Process pool.
+ * ***************************************************************************************/
+#define POOL_CHECK_MS (100)     /* How often an idle parent checks its workers */
+
+/* One slot of a ring, see pool_enqueue */
+typedef struct {
+    unsigned long seq;
+    int from;                   /* Worker that enqueued the job, or -1 */
+    pool_job_t job;
+} pool_cell_t;
+
+/*
+ * A consumer takes the cell at position pos by swapping its seq for
+ * POOL_CLAIM(pos, self), which names the consumer. The claim commits the
+ * dequeue, so a worker that dies holding a job leaves it named in its
+ * cell, or in running[] once it has copied the job out.
+ */
+#define POOL_CLAIMED (1UL << 63)
+#define POOL_POS_BITS (48)
+#define POOL_CLAIM(pos, self) (POOL_CLAIMED \
+    | (unsigned long)(self) << POOL_POS_BITS \
+    | ((pos) & ((1UL << POOL_POS_BITS) - 1)))
+#define POOL_CLAIM_POS(seq) ((seq) & ((1UL << POOL_POS_BITS) - 1))
+#define POOL_CLAIM_SELF(seq) ((int)(((seq) & ~POOL_CLAIMED) >> POOL_POS_BITS))
+#define POOL_PARENT (0x7fff)    /* self of the parent */
+
+/*
+ * Bounded multi-producer multi-consumer ring (after D. Vyukov's design).
+ * Each cell carries a sequence number telling whether it is ready to be
+ * written (seq == pos), read (seq == pos + 1), or is being read (claimed)
+ * at ring position pos. head and tail live on separate cache lines.
+ */
+typedef struct {
+    unsigned long head;         /* Next position to write */
+    char pad1[64 - sizeof(unsigned long)];
+    unsigned long tail;         /* Next position to read */
+    char pad2[64 - sizeof(unsigned long)];
+    int avail;                  /* Futex word, bumped on every enqueue */
+    int waiters;                /* Consumers sleeping on avail */
+    pool_cell_t cells[POOL_QSIZE];
+} pool_queue_t;
+
+/* The part of the pool shared with the workers */
+typedef struct {
+    pool_queue_t jobs;          /* parent -> workers */
+    pool_queue_t results;       /* workers -> parent */
+    int shutdown;               /* Set by pool_destroy */
+    long running[];             /* Job id each worker is running, or -1 */
+} pool_shared_t;
+
+struct pool {
+    pool_shared_t *sh;
+    size_t shsize;
+    pool_fn_t *fn;
+    int nworkers;
+    pid_t *pids;                /* Worker i's pid */
+    long *collected;            /* Id of the last result of worker i taken */
+    long next_id;               /* Id of the next job submitted */
+    long inflight;              /* Jobs submitted but not collected */
+};
+
+/**
+ * pool_enqueue - Appends @job, from worker @from (-1 for none), to @q and
+ * wakes up one sleeping consumer. Never blocks.
+ *
+ * @return 1 on success, 0 if @q is full.
+ */
+static int pool_enqueue(pool_queue_t *q, pool_job_t *job, int from)
+{
+    pool_cell_t *cell;
+    unsigned long pos, seq;
+    long dif;
+
+    pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    while (1) {
+        cell = &q->cells[pos & (POOL_QSIZE - 1)];
+        seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        dif = (long)seq - (long)pos;
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (dif < 0)
+            return 0;           /* Full, or not read yet */
+        else
+            pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    }
+    cell->job = *job;
+    cell->from = from;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+    __atomic_add_fetch(&q->avail, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&q->waiters, __ATOMIC_SEQ_CST) > 0)
+        futex_wake(&q->avail, 1);
+    return 1;
+}
+
+/**
+ * pool_dequeue - Removes the oldest job of @q into @job, and the worker
+ * it came from into *@from, for consumer @self. If @running is not NULL,
+ * the job id is stored there before the cell is given back. Never blocks.
+ *
+ * @return 1 on success, 0 if @q is empty.
+ */
+static int pool_dequeue(pool_queue_t *q, pool_job_t *job, int *from,
+                        int self, long *running)
+{
+    pool_cell_t *cell;
+    unsigned long pos, seq;
+    long dif;
+
+    pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    while (1) {
+        cell = &q->cells[pos & (POOL_QSIZE - 1)];
+        seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        if (seq & POOL_CLAIMED) {
+            /* Claimed, but tail not moved past it yet: help. A claim of
+               the lap before means the ring is empty */
+            if (seq != POOL_CLAIM(pos, POOL_CLAIM_SELF(seq)))
+                return 0;
+            __atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+            pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+            continue;
+        }
+        dif = (long)seq - (long)(pos + 1);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&cell->seq, &seq,
+                                            POOL_CLAIM(pos, self), 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+                break;
+            pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+        }
+        else if (dif < 0)
+            return 0;           /* Empty */
+        else
+            pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    }
+    __atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 0,
+                                __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    *job = cell->job;
+    if (from != NULL)
+        *from = cell->from;
+    if (running != NULL)
+        __atomic_store_n(running, job->id, __ATOMIC_RELAXED);
+    __atomic_store_n(&cell->seq, pos + POOL_QSIZE, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/**
+ * pool_dequeue_wait - Like pool_dequeue, but sleeps at most @timeout
+ * milliseconds (-1 = forever) while @q is empty. Also returns 0 as soon
+ * as @q is empty and *@stop is non-zero.
+ */
+static int pool_dequeue_wait(pool_queue_t *q, pool_job_t *job, int *from,
+                             int self, long *running, int *stop, int timeout)
+{
+    int avail, timedout;
+
+    while (1) {
+        /* Read avail first: an enqueue after this makes futex_wait fail */
+        avail = __atomic_load_n(&q->avail, __ATOMIC_SEQ_CST);
+        if (pool_dequeue(q, job, from, self, running))
+            return 1;
+        if (stop != NULL && __atomic_load_n(stop, __ATOMIC_ACQUIRE))
+            return 0;
+
+        __atomic_add_fetch(&q->waiters, 1, __ATOMIC_SEQ_CST);
+        timedout = futex_wait(&q->avail, avail, timeout);
+        __atomic_sub_fetch(&q->waiters, 1, __ATOMIC_SEQ_CST);
+        if (timedout)
+            return 0;
+    }
+}
+
+/**
+ * pool_worker - Main loop of worker @i. Never returns.
+ */
+static void pool_worker(pool_t *pool, int i)
+{
+    pool_shared_t *sh = pool->sh;
+    pool_job_t job;
+
+    while (pool_dequeue_wait(&sh->jobs, &job, NULL, i, &sh->running[i],
+                             &sh->shutdown, -1)) {
+        job.result = pool->fn(job.arg);
+        job.status = 0;
+        pool_enqueue(&sh->results, &job, i);
+        __atomic_store_n(&sh->running[i], -1, __ATOMIC_RELEASE);
+    }
+    _exit(0);
+}
+
+/**
+ * pool_spawn - Forks worker @i.
+ */
+static void pool_spawn(pool_t *pool, int i)
+{
+    pool->sh->running[i] = -1;
+    pool->collected[i] = -1;
+    if ((pool->pids[i] = Fork()) == 0)
+        pool_worker(pool, i);
+}
+
+/**
+ * pool_posted - Returns 1 if the result of job @id waits in @q, whose
+ * only consumer is the caller.
+ */
+static int pool_posted(pool_queue_t *q, long id)
+{
+    unsigned long pos, head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+    pool_cell_t *cell;
+
+    for (pos = q->tail; pos != head; pos++) {
+        cell = &q->cells[pos & (POOL_QSIZE - 1)];
+        if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) == pos + 1 &&
+            cell->job.id == id)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * pool_fail - Reports job @id as failed with wait status @status.
+ */
+static void pool_fail(pool_t *pool, long id, int status)
+{
+    pool_job_t job;
+
+    job.id = id;
+    job.arg = 0;
+    job.result = 0;
+    job.status = status ? status : -1;
+    pool_enqueue(&pool->sh->results, &job, -1);
+}
+
+/**
+ * pool_check - Reaps crashed workers, fails the job each of them held and
+ * forks replacements. A dead worker holds the job of a cell it claimed
+ * and did not give back, else the job in running[] unless its result was
+ * posted, whether it has been collected already or still waits.
+ */
+static void pool_check(pool_t *pool)
+{
+    pool_queue_t *jobs = &pool->sh->jobs;
+    unsigned long seq, pos;
+    int i, k, status;
+    long id;
+
+    for (i = 0; i < pool->nworkers; i++) {
+        if (Waitpid(pool->pids[i], &status, WNOHANG) == 0)
+            continue;
+
+        /* Worker i is gone, all of its writes are visible by now */
+        id = pool->sh->running[i];
+        for (k = 0; k < POOL_QSIZE; k++) {
+            seq = __atomic_load_n(&jobs->cells[k].seq, __ATOMIC_ACQUIRE);
+            if (!(seq & POOL_CLAIMED) || POOL_CLAIM_SELF(seq) != i)
+                continue;
+            id = jobs->cells[k].job.id;
+            pos = POOL_CLAIM_POS(seq);
+            __atomic_compare_exchange_n(&jobs->tail, &pos, pos + 1, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+            __atomic_store_n(&jobs->cells[k].seq, POOL_CLAIM_POS(seq) +
+                             POOL_QSIZE, __ATOMIC_RELEASE);
+            break;
+        }
+        if (id >= 0 && id != pool->collected[i] &&
+            !pool_posted(&pool->sh->results, id))
+            pool_fail(pool, id, status);
+        pool_spawn(pool, i);
+    }
+}
+
+pool_t *pool_create(int nworkers, pool_fn_t *fn)
+{
+    pool_t *pool;
+    int i;
+
+    pool = Malloc(sizeof(pool_t));
+    pool->shsize = sizeof(pool_shared_t) + nworkers * sizeof(long);
+    pool->sh = Mmap(NULL, pool->shsize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    pool->fn = fn;
+    pool->nworkers = nworkers;
+    pool->pids = Malloc(nworkers * sizeof(pid_t));
+    pool->collected = Malloc(nworkers * sizeof(long));
+    pool->next_id = 0;
+    pool->inflight = 0;
+
+    /* The region is zero-filled, only the sequence numbers need a value */
+    for (i = 0; i < POOL_QSIZE; i++) {
+        pool->sh->jobs.cells[i].seq = i;
+        pool->sh->results.cells[i].seq = i;
+    }
+
+    fflush(stdout);             /* Do not let the workers inherit output */
+    for (i = 0; i < nworkers; i++)
+        pool_spawn(pool, i);
+    return pool;
+}
+
+long pool_submit(pool_t *pool, long arg)
+{
+    pool_job_t job;
+
+    /* Bounding the jobs in flight means neither ring can overflow */
+    if (pool->inflight == POOL_QSIZE)
+        return -1;
+
+    job.id = pool->next_id++;
+    job.arg = arg;
+    job.result = 0;
+    job.status = 0;
+    pool_enqueue(&pool->sh->jobs, &job, -1);
+    pool->inflight++;
+    return job.id;
+}
+
+int pool_result(pool_t *pool, pool_job_t *job)
+{
+    int from;
+
+    if (pool->inflight == 0)
+        return 0;
+
+    while (!pool_dequeue_wait(&pool->sh->results, job, &from, POOL_PARENT,
+                              NULL, NULL, POOL_CHECK_MS))
+        pool_check(pool);
+    if (from >= 0)
+        pool->collected[from] = job->id;
+    pool->inflight--;
+    return 1;
+}
+
+void pool_destroy(pool_t *pool)
+{
+    pool_shared_t *sh = pool->sh;
+    int i;
+
+    /* Bump avail too, so that no worker goes to sleep on a stale value */
+    __atomic_store_n(&sh->shutdown, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&sh->jobs.avail, 1, __ATOMIC_SEQ_CST);
+    futex_wake(&sh->jobs.avail, INT_MAX);
+
+    for (i = 0; i < pool->nworkers; i++)
+        Waitpid(pool->pids[i], NULL, 0);
+
+    Munmap(sh, pool->shsize);
+    Free(pool->pids);
+    Free(pool->collected);
+    Free(pool);
+}
@@ -0,0 +1,290 @@
+#include "common.h"
+#include "trace.h"
+
+/**
+ * csim - Replays a memory trace through a hierarchy of set-associative
+ * caches and reports the hits, misses and evictions of each level.
+ *
+ * A cache has S = 2^s sets of E lines of B = 2^b bytes. The trace is
+ * either valgrind lackey's text output (valgrind --tool=lackey
+ * --trace-mem=yes), whose instruction fetches are ignored, or a binary
+ * trace (see trace.h) as written by trace_ref or by -w. Either is mapped,
+ * not read, so traces larger than memory stream through the page cache.
+ *
+ * A reference that misses in a level goes on to the next one, and its
+ * line is loaded in every level it missed in. A modify is a load followed
+ * by a store, which hits. References are taken as a whole, even when they
+ * straddle two lines. Each level replaces lines according to its policy:
+ *
+ *   lru         the least recently used line
+ *   fifo        the line loaded first
+ *   random      any line
+ *
+ * The tags of a set are packed together, most recently used (or newest)
+ * first, so most hits are found at the first compare.
+ *
+ * usage: csim [-hvP] [-s <s> -E <E> -b <b> [-p <policy>]]
+ *             [-L <s>,<E>,<b>[,<policy>]]... [-w <out>] -t <tracefile>
+ *
+ * -s, -E, -b and -p describe the first level, as in the CS:APP cache lab;
+ * each -L adds a level below the ones before it. -w also writes the trace
+ * in binary to <out>, -v prints what happens to every reference, -P the
+ * performance counters of the simulation.
+ */
+#define MAXLEVELS (8)
+#define INVALID (~(uint64_t)0)  /* Tag of an empty line */
+
+enum { LRU, FIFO, RANDOM };
+static char *policies[] = {"lru", "fifo", "random"};
+
+/* A level of the hierarchy */
+typedef struct {
+    int s, E, b;
+    int policy;
+    uint64_t set_mask;          /* S - 1 */
+    uint64_t *tags;             /* S sets of E tags, the line addresses */
+    unsigned long hits, misses, evictions;
+} cache_t;
+
+/* Private global variables */
+static cache_t levels[MAXLEVELS];
+static int nlevels;
+static int verbose;
+static unsigned long nrefs;     /* References replayed */
+static char *out;               /* Binary copy of the trace, or NULL */
+static uint64_t seed = 88172645463325252ULL;    /* For random */
+
+/* Outcomes of an access to one level */
+enum { HIT, MISS, EVICTION };
+
+static void usage(char *prog)
+{
+    fprintf(stderr, "usage: %s [-hvP] [-s <s> -E <E> -b <b> [-p <policy>]]\n"
+            "       [-L <s>,<E>,<b>[,<policy>]]... [-w <out>] -t <tracefile>\n"
+            "policies: lru (default), fifo, random\n", prog);
+    exit(1);
+}
+
+/* xorshift - Returns the next pseudo-random number */
+static uint64_t xorshift(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+/* cache_init - Sets up empty level @c, or exits if it is not valid */
+static void cache_init(cache_t *c, int s, int E, int b, char *policy)
+{
+    size_t i, n;
+
+    if (s < 0 || E < 1 || b < 0 || s + b > 40)
+        app_error("csim: invalid cache parameters");
+    for (c->policy = 0; c->policy < 3; c->policy++)
+        if (!strcmp(policy, policies[c->policy]))
+            break;
+    if (c->policy == 3)
+        app_error("csim: unknown replacement policy");
+    c->s = s;
+    c->E = E;
+    c->b = b;
+    c->set_mask = ((uint64_t)1 << s) - 1;
+    n = ((size_t)1 << s) * E;
+    c->tags = Malloc(n * sizeof(uint64_t));
+    for (i = 0; i < n; i++)
+        c->tags[i] = INVALID;
+}
+
+/**
+ * cache_access - Looks up the line of @addr in level @c and loads it on a
+ * miss. Valid lines are kept at the front of their set.
+ *
+ * @return HIT, MISS, or EVICTION if a line had to make room.
+ */
+static inline int cache_access(cache_t *c, uint64_t addr)
+{
+    uint64_t line = addr >> c->b;
+    uint64_t *set = c->tags + (line & c->set_mask) * c->E;
+    int i, r, E = c->E;
+
+    if (set[0] == line) {
+        c->hits++;
+        return HIT;
+    }
+    for (i = 1; i < E && set[i] != INVALID; i++) {
+        if (set[i] == line) {
+            c->hits++;
+            if (c->policy == LRU) {
+                for (; i > 0; i--)
+                    set[i] = set[i - 1];
+                set[0] = line;
+            }
+            return HIT;
+        }
+    }
+
+    c->misses++;
+    if (set[E - 1] == INVALID)
+        r = MISS;
+    else {
+        c->evictions++;
+        r = EVICTION;
+        if (c->policy == RANDOM) {
+            set[xorshift() % E] = line;
+            return r;
+        }
+    }
+    for (i = E - 1; i > 0; i--)
+        set[i] = set[i - 1];
+    set[0] = line;
+    return r;
+}
+
+/* access_all - Sends an access to @addr down the hierarchy */
+static inline void access_all(uint64_t addr)
+{
+    static char *outcomes[] = {"hit", "miss", "miss eviction"};
+    int i, r;
+
+    for (i = 0; i < nlevels; i++) {
+        r = cache_access(&levels[i], addr);
+        if (verbose)
+            printf(" L%d %s", i + 1, outcomes[r]);
+        if (r == HIT)
+            break;
+    }
+}
+
+/* simulate - Replays one reference, and copies it to the binary trace */
+static void simulate(int op, uint64_t addr, int size, void *arg)
+{
+    nrefs++;
+    if (verbose)
+        printf("%c %llx,%d", op, (unsigned long long)addr, size);
+    access_all(addr);
+    if (op == 'M')
+        access_all(addr);
+    if (verbose)
+        printf("\n");
+    if (out)
+        trace_ref(op, (void *)(uintptr_t)addr, size);
+}
+
+/**
+ * replay_binary - Replays the @n references of a binary trace. The first
+ * compare in the first level is done here, with the level's parameters in
+ * registers: most references stop there.
+ */
+static void replay_binary(const uint64_t *refs, size_t n)
+{
+    cache_t *l1 = &levels[0];
+    const uint64_t *tags = l1->tags, mask = l1->set_mask;
+    uint64_t addr, line;
+    unsigned long hits = 0;
+    int b = l1->b, E = l1->E;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        addr = TRACE_ADDR(refs[i]);
+        line = addr >> b;
+        if (tags[(line & mask) * E] == line)
+            hits++;
+        else
+            access_all(addr);
+        if (TRACE_OP(refs[i]) == 'M')
+            hits++;         /* The store of a modify always hits */
+    }
+    l1->hits += hits;
+    nrefs += n;
+}
+
+int main(int argc, char **argv)
+{
+    int c, s = -1, E = -1, b = -1, pflag = 0, i, nspecs = 0;
+    char *policy = "lru", *file = NULL, *specs[MAXLEVELS], name[16];
+    unsigned long refs;
+    trace_file_t trace;
+    double start, t;
+    cache_t *l;
+
+    while ((c = getopt(argc, argv, "hvPs:E:b:p:L:w:t:")) != -1) {
+        switch (c) {
+            case 'v':
+                verbose = 1;
+                break;
+            case 'P':
+                pflag = 1;
+                break;
+            case 's':
+                s = atoi(optarg);
+                break;
+            case 'E':
+                E = atoi(optarg);
+                break;
+            case 'b':
+                b = atoi(optarg);
+                break;
+            case 'p':
+                policy = optarg;
+                break;
+            case 'L':
+                if (nspecs == MAXLEVELS - 1)
+                    app_error("csim: too many levels");
+                specs[nspecs++] = optarg;
+                break;
+            case 'w':
+                out = optarg;
+                break;
+            case 't':
+                file = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (file == NULL || (s < 0 && nspecs == 0))
+        usage(argv[0]);
+
+    /* The first level, then the ones of -L */
+    if (s >= 0 || E >= 0 || b >= 0) {
+        if (s < 0 || E < 0 || b < 0)
+            usage(argv[0]);
+        cache_init(&levels[nlevels++], s, E, b, policy);
+    }
+    for (i = 0; i < nspecs; i++) {
+        strcpy(name, "lru");
+        if (sscanf(specs[i], "%d,%d,%d,%15s", &s, &E, &b, name) < 3)
+            usage(argv[0]);
+        cache_init(&levels[nlevels++], s, E, b, name);
+    }
+
+    trace_map(&trace, file);
+    if (out)
+        trace_open(out);
+
+    PERF_BEGIN("simulate");
+    start = clock_now();
+    if (trace.refs && !verbose && !out)
+        replay_binary(trace.refs, trace.nrefs);
+    else
+        trace_replay(&trace, simulate, NULL);
+    t = clock_now() - start;
+    PERF_END("simulate");
+
+    trace_close();
+    trace_unmap(&trace);
+
+    for (i = 0; i < nlevels; i++) {
+        l = &levels[i];
+        refs = l->hits + l->misses;
+        printf("L%d s=%d E=%d b=%d %-6s hits:%lu misses:%lu evictions:%lu "
+               "miss rate:%.2f%%\n", i + 1, l->s, l->E, l->b,
+               policies[l->policy], l->hits, l->misses, l->evictions,
+               refs ? 100.0 * l->misses / refs : 0);
+    }
+    printf("%lu references in %.3f s, %.1f M/s\n", nrefs, t, nrefs / t / 1e6);
+    if (pflag)
+        perf_report(stdout);
+    return 0;
+}
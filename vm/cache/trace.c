@@ -0,0 +1,121 @@
+#include "common.h"
+#include "trace.h"
+
+#define TRACE_BUF (8192)        /* References buffered per write */
+
+/* Private global variables */
+static int trace_fd = -1;               /* Trace file, -1 if none */
+static uint64_t trace_buf[TRACE_BUF];   /* References not written yet */
+static int trace_n;                     /* How many */
+
+/* trace_flush - Writes out the buffered references */
+static void trace_flush(void)
+{
+    Rio_writen(trace_fd, trace_buf, trace_n * sizeof(uint64_t));
+    trace_n = 0;
+}
+
+void trace_open(char *path)
+{
+    if (trace_fd >= 0)
+        trace_close();
+    trace_fd = Open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    Rio_writen(trace_fd, TRACE_MAGIC, 8);
+}
+
+void trace_ref(int op, const void *addr, int size)
+{
+    if (trace_fd < 0)
+        return;
+    trace_buf[trace_n++] = TRACE_REF(op, size, (uintptr_t)addr);
+    if (trace_n == TRACE_BUF)
+        trace_flush();
+}
+
+void trace_close(void)
+{
+    if (trace_fd < 0)
+        return;
+    trace_flush();
+    Close(trace_fd);
+    trace_fd = -1;
+}
+
+void trace_map(trace_file_t *t, char *path)
+{
+    struct stat st;
+    int fd;
+
+    fd = Open(path, O_RDONLY, 0);
+    if (fstat(fd, &st) < 0)
+        unix_error("fstat error");
+    if (st.st_size == 0)
+        app_error("trace_map: empty trace");
+    t->size = st.st_size;
+    t->map = Mmap(NULL, t->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    madvise(t->map, t->size, MADV_SEQUENTIAL);
+    Close(fd);
+
+    if (t->size >= 8 && !memcmp(t->map, TRACE_MAGIC, 8)) {
+        t->refs = (uint64_t *)(t->map + 8);
+        t->nrefs = (t->size - 8) / 8;
+    }
+    else {
+        t->refs = NULL;
+        t->nrefs = 0;
+    }
+}
+
+/**
+ * replay_text - Replays the lackey trace of @t. Data references are
+ * indented by a space: " L addr,size"; instruction fetches ("I  addr,size")
+ * and valgrind's messages ("==pid== ...") are not.
+ */
+static void replay_text(trace_file_t *t, trace_fn_t *fn, void *arg)
+{
+    static signed char hex[256];
+    const char *p = t->map, *end = t->map + t->size, *eol;
+    uint64_t addr;
+    int i, op, len;
+
+    memset(hex, -1, sizeof(hex));
+    for (i = 0; i < 10; i++)
+        hex['0' + i] = i;
+    for (i = 0; i < 6; i++)
+        hex['a' + i] = hex['A' + i] = 10 + i;
+
+    for (; p < end; p = eol + 1) {
+        if ((eol = memchr(p, '\n', end - p)) == NULL)
+            eol = end;
+        if (eol - p < 4 || p[0] != ' ')
+            continue;
+        op = p[1];
+        if (op != 'L' && op != 'S' && op != 'M')
+            continue;
+        for (addr = 0, p += 3; p < eol && hex[(unsigned char)*p] >= 0; p++)
+            addr = addr << 4 | hex[(unsigned char)*p];
+        len = 0;
+        if (p < eol && *p == ',')
+            for (p++; p < eol && *p >= '0' && *p <= '9'; p++)
+                len = len * 10 + *p - '0';
+        fn(op, addr, len, arg);
+    }
+}
+
+void trace_replay(trace_file_t *t, trace_fn_t *fn, void *arg)
+{
+    size_t i;
+
+    if (t->refs == NULL) {
+        replay_text(t, fn, arg);
+        return;
+    }
+    for (i = 0; i < t->nrefs; i++)
+        fn(TRACE_OP(t->refs[i]), TRACE_ADDR(t->refs[i]),
+           TRACE_SIZE(t->refs[i]), arg);
+}
+
+void trace_unmap(trace_file_t *t)
+{
+    Munmap(t->map, t->size);
+}
@@ -0,0 +1,71 @@
+#include "common.h"
+#include "trace.h"
+
+/**
+ * tracegen - Writes the trace of summing an N x N matrix of ints R times,
+ * row by row (stride 1: one miss per line) or, with -c, column by column
+ * (stride N: a miss per reference once a column's lines do not fit), for
+ * csim to replay. The trace is binary, or lackey text with -l.
+ *
+ * usage: tracegen [-cl] [-n N] [-r R] file    (default: N = 1024, R = 1)
+ */
+
+int main(int argc, char **argv)
+{
+    int c, cols = 0, text = 0, n = 1024, rounds = 1, r, i, j;
+    int *a;
+    long sum = 0;
+    FILE *fp = NULL;
+
+    while ((c = getopt(argc, argv, "cln:r:")) != -1) {
+        switch (c) {
+            case 'c':
+                cols = 1;
+                break;
+            case 'l':
+                text = 1;
+                break;
+            case 'n':
+                n = atoi(optarg);
+                break;
+            case 'r':
+                rounds = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-cl] [-n N] [-r R] file\n", argv[0]);
+                exit(1);
+        }
+    }
+    if (optind != argc - 1 || n <= 0)
+        app_error("usage: tracegen [-cl] [-n N] [-r R] file");
+
+    a = Calloc((size_t)n * n, sizeof(int));
+    if (text) {
+        if ((fp = fopen(argv[optind], "w")) == NULL)
+            unix_error(argv[optind]);
+    }
+    else
+        trace_open(argv[optind]);
+
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < n; i++) {
+            for (j = 0; j < n; j++) {
+                int *p = cols ? &a[(size_t)j * n + i] : &a[(size_t)i * n + j];
+
+                sum += *p;
+                if (text)
+                    fprintf(fp, " L %08lx,%d\n", (unsigned long)p,
+                            (int)sizeof(int));
+                else
+                    trace_ref('L', p, sizeof(int));
+            }
+        }
+    }
+
+    if (text)
+        fclose(fp);
+    else
+        trace_close();
+    Free(a);
+    return sum != 0;
+}
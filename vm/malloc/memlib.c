@@ -1,12 +1,15 @@
 #include "common.h"
 #include "memlib.h"
+#include "vmsim.h"
 
 #define MAX_HEAP (20 * (1 << 20))   /* 20 MB */
+#define HUGE_PAGE (1 << 21)         /* 2 MB */
 
 /* Private global variables */
 static char *mem_heap;      /* Points to first byte of the heap */
 static char *mem_brk;       /* Points to last byte of heap plus 1 */
 static char *mem_max_addr;  /* Max legal heap addr plus 1 */
+static size_t mem_page;     /* Size of the pages backing the heap */
 
 /**
  * mem_init - Initialize the memory system model.
@@ -29,9 +32,79 @@ static char *mem_max_addr;  /* Max legal heap addr plus 1 */
  */
 void mem_init(void)
 {
-    mem_heap = (char *) Malloc(MAX_HEAP);
+    mem_init_pages(MEM_SMALL_PAGES);
+}
+
+/* thp_enabled - Returns 1 if the kernel gives huge pages to madvise */
+static int thp_enabled(void)
+{
+    char buf[128] = "";
+    int fd;
+
+    if ((fd = open("/sys/kernel/mm/transparent_hugepage/enabled",
+                   O_RDONLY)) < 0)
+        return 0;
+    if (read(fd, buf, sizeof(buf) - 1) < 0)
+        buf[0] = '\0';
+    close(fd);
+    return strstr(buf, "[never]") == NULL && buf[0] != '\0';
+}
+
+/**
+ * mem_init_pages - Initialize the memory system model, on pages of
+ * @pages, which falls back to the next kind if the kernel has none:
+ *     MEM_HUGETLB      2 MB pages from the hugetlbfs pool
+ *     MEM_THP          transparent huge pages, asked for with madvise
+ *     MEM_SMALL_PAGES  base pages
+ * The heap is aligned to 2 MB in any case.
+ */
+int mem_init_pages(int pages)
+{
+    char *p, *start;
+
+    mem_page = getpagesize();
+    if (pages == MEM_HUGETLB) {
+        p = mmap(NULL, MAX_HEAP, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            mem_heap = p;
+            mem_page = HUGE_PAGE;
+            goto done;
+        }
+        pages = MEM_THP;
+    }
+
+    /* Trim a bigger mapping down to a 2 MB aligned heap */
+    p = Mmap(NULL, MAX_HEAP + HUGE_PAGE, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    start = (char *)(((uintptr_t)p + HUGE_PAGE - 1) & ~(uintptr_t)(HUGE_PAGE - 1));
+    if (start > p)
+        Munmap(p, start - p);
+    if (start + MAX_HEAP < p + MAX_HEAP + HUGE_PAGE)
+        Munmap(start + MAX_HEAP, p + HUGE_PAGE - start);
+    mem_heap = start;
+
+    if (pages == MEM_THP) {
+        if (thp_enabled() && madvise(mem_heap, MAX_HEAP, MADV_HUGEPAGE) == 0)
+            mem_page = HUGE_PAGE;
+        else
+            pages = MEM_SMALL_PAGES;
+    }
+
+ done:
     mem_brk = (char *)mem_heap;
     mem_max_addr = (char *)(mem_heap + MAX_HEAP);
+    return pages;
+}
+
+/**
+ * mem_deinit - Frees the storage used by the memory system model.
+ */
+void mem_deinit(void)
+{
+    mem_reset_brk();
+    Munmap(mem_heap, MAX_HEAP);
+    mem_heap = mem_brk = mem_max_addr = NULL;
 }
 
 /**
@@ -61,6 +134,10 @@ void *mem_sbrk(int incr)
     }
 
     mem_brk += incr;
+
+    /* The kernel backs the heap a whole page of mem_pagesize() at a time */
+    vm_map(old_brk, (((uintptr_t)mem_brk + mem_page - 1) & ~(mem_page - 1))
+           - (uintptr_t)old_brk);
     return (void *)old_brk;
 }
 
@@ -69,6 +146,7 @@ void *mem_sbrk(int incr)
  */
 void mem_reset_brk(void)
 {
+    vm_unmap(mem_heap, mem_brk - mem_heap);
     mem_brk = (char *) mem_heap;
 }
 
@@ -97,9 +175,10 @@ size_t mem_heapsize(void)
 }
 
 /**
- * mem_pagesize - returns the page size of the system.
+ * mem_pagesize - returns the size of the pages backing the heap: the page
+ * size of the system, or 2 MB on huge pages.
  */
 size_t mem_pagesize(void)
 {
-    return (size_t)getpagesize();
+    return mem_page ? mem_page : (size_t)getpagesize();
 }
@@ -1,18 +1,40 @@
 /*****************************************************************************************
  * memlib.h - A module that simulates the memory system.
  ****************************************************************************************/
+#ifndef __MEMLIB_H__
+#define __MEMLIB_H__
+
+#include <stddef.h>
+
+/* Pages the heap can be backed with */
+enum { MEM_SMALL_PAGES, MEM_THP, MEM_HUGETLB };
 
 /**
  * mem_init - Initialize the memory system model
  */
 void mem_init(void);
 
+/**
+ * mem_init_pages - Initialize the memory system model on pages of kind
+ * @pages, or on the next kind down if the kernel cannot provide them:
+ * hugetlbfs pages, then transparent huge pages, then base pages.
+ *
+ * @return the kind of pages the heap is on.
+ */
+int mem_init_pages(int pages);
+
+/**
+ * mem_deinit - Frees the storage used by the memory system model.
+ */
+void mem_deinit(void);
+
 /**
  * mem_sbrk - Simple model of the sbrk function. Extends the heap by
  * @incr bytes and returns the start address of the new area.
- * In this model, the heap cannot be shrunk.
+ * In this model, the heap cannot be shrunk. The new area is mapped in the
+ * address translation model of vmsim.h, if one is running.
  */
-void mem_sbrk(int incr);
+void *mem_sbrk(int incr);
 
 /**
  * mem_reset_brk - Resets the simulated brk pointer to make an empty heap.
@@ -35,6 +57,9 @@ void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 
 /**
- * mem_pagesize - returns the page size of the system.
+ * mem_pagesize - returns the size of the pages backing the heap: the page
+ * size of the system, or 2 MB on huge pages.
  */
 size_t mem_pagesize(void);
+
+#endif /* __MEMLIB_H__ */
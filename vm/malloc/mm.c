@@ -0,0 +1,906 @@
+/*
+ * mm.c - Segregated fits with boundary tags, as in CS:APP 9.9.14.
+ *
+ * A block is a header word, the payload and a footer word, both tags
+ * holding the size of the block and whether it is allocated. The heap
+ * starts with an allocated prologue block of just its tags and ends with
+ * an allocated epilogue header of size 0, so coalescing needs no edge
+ * cases:
+ *
+ *   | pad | prologue hdr | prologue ftr | hdr | payload | ftr | ... | epilogue hdr |
+ *                                              ^
+ *                                              bp, aligned to DSIZE
+ *
+ * A free block keeps the links of its free list in its payload: the
+ * previous block of the list first, then the next one. List i holds the
+ * free blocks of size [MINBLOCK * 2^i, MINBLOCK * 2^(i+1)), the last list
+ * everything bigger. Freed blocks go to the front of their list.
+ *
+ * With mm_defer, freed blocks of up to QUICK_MAX bytes are not coalesced
+ * but pushed on a quick list of their exact size, still tagged allocated,
+ * for the next request of that size. They are coalesced in bulk when a
+ * request finds no fit, or when more than the limit of bytes wait.
+ *
+ * With mm_check_every, every so many calls check a slice of the heap from
+ * a cursor that goes round it, and stop the program at the first error.
+ * Blocks that merge into the one before them move the cursor there.
+ *
+ * With mm_trace, every read and write of a tag or a link goes to a trace
+ * that csim can replay (see trace.h), the allocator's own memory traffic.
+ */
+#include "common.h"
+#include "memlib.h"
+#include "mm.h"
+#include "trace.h"
+
+/* Basic constants and macros */
+#define WSIZE 8                 /* Word and header/footer size (bytes) */
+#define DSIZE 16                /* Double word size, the alignment (bytes) */
+#define CHUNKSIZE (1 << 12)     /* Extend heap by this amount (bytes) */
+#define MINBLOCK (2 * DSIZE)    /* Tags and the two links of a free block */
+#define NCLASSES (20)           /* Free lists */
+#define MAX_BLOCK (1 << 30)     /* mem_sbrk takes an int */
+#define QUICK_MAX (512)         /* Biggest block kept on the quick lists */
+#define DUMP_BUF (512)          /* Words written at a time by mm_dump */
+
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+#define ALIGN(size) (((size) + DSIZE - 1) & ~(size_t)(DSIZE - 1))
+
+/* Pack a size and allocated bit into a word */
+#define PACK(size, alloc) ((size) | (alloc))
+
+/* Read and write a word at address p, traced */
+#define GET(p) get(p)
+#define PUT(p, val) put(p, val)
+
+/* Read the size and allocated fields from address p */
+#define GET_SIZE(p) (GET(p) & ~(size_t)(DSIZE - 1))
+#define GET_ALLOC(p) (GET(p) & 0x1)
+
+/* Given block ptr bp, compute address of its header and footer */
+#define HDRP(bp) ((char *)(bp) - WSIZE)
+#define FTRP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
+
+/* Given block ptr bp, compute address of next and previous blocks */
+#define NEXT_BLKP(bp) ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
+#define PREV_BLKP(bp) ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
+
+/* Given free block ptr bp, read and write its neighbours on its free list */
+#define PRED(bp) ((char *)GET(bp))
+#define SUCC(bp) ((char *)GET((char *)(bp) + WSIZE))
+#define SET_PRED(bp, p) PUT(bp, (size_t)(p))
+#define SET_SUCC(bp, p) PUT((char *)(bp) + WSIZE, (size_t)(p))
+
+/* Given block ptr bp on a quick list or a batch, read and write the next */
+#define QNEXT(bp) ((char *)GET(bp))
+#define SET_QNEXT(bp, p) PUT(bp, (size_t)(p))
+
+/* Private global variables */
+static char *heap_listp;        /* The prologue block */
+static char *lists[NCLASSES];   /* Heads of the free lists */
+static size_t huge;             /* Huge page size, 0 on base pages */
+static int huge_align = 1;      /* Align large blocks on huge pages */
+static char *quick[QUICK_MAX / DSIZE + 1];  /* Quick lists by size */
+static size_t quick_bytes;      /* Bytes on the quick lists */
+static size_t quick_limit;      /* Most bytes they hold, 0 for none */
+static long nquick;             /* Blocks on the quick lists */
+static char *check_bp;          /* Next block to check, NULL for the first */
+static int check_calls;         /* Calls between checks, 0 for none */
+static int check_blocks;        /* Blocks checked each time */
+static int check_countdown;     /* Calls until the next check */
+static int tracing;             /* Tag and link references are traced */
+
+/* get - Returns the word at @p */
+static inline size_t get(const void *p)
+{
+    if (tracing)
+        trace_ref('L', p, WSIZE);
+    return *(const size_t *)p;
+}
+
+/* put - Stores @val in the word at @p */
+static inline void put(void *p, size_t val)
+{
+    if (tracing)
+        trace_ref('S', p, WSIZE);
+    *(size_t *)p = val;
+}
+
+
+/*****************************************************************************************
+ * Free lists.
+ * ***************************************************************************************/
+/* class_of - Returns the free list of blocks of @size bytes */
+static int class_of(size_t size)
+{
+    int c = (63 - __builtin_clzl(size)) - 5;   /* log2(size / MINBLOCK) */
+
+    return c < NCLASSES ? c : NCLASSES - 1;
+}
+
+static void insert(char *bp)
+{
+    char **head = &lists[class_of(GET_SIZE(HDRP(bp)))];
+
+    SET_PRED(bp, NULL);
+    SET_SUCC(bp, *head);
+    if (*head)
+        SET_PRED(*head, bp);
+    *head = bp;
+}
+
+static void remove_free(char *bp)
+{
+    char *pred = PRED(bp), *succ = SUCC(bp);
+
+    if (pred)
+        SET_SUCC(pred, succ);
+    else
+        lists[class_of(GET_SIZE(HDRP(bp)))] = succ;
+    if (succ)
+        SET_PRED(succ, pred);
+}
+
+
+/*****************************************************************************************
+ * Blocks.
+ * ***************************************************************************************/
+/* absorb - Notes that block @bp is now part of the block @into before it */
+static void absorb(char *into, char *bp)
+{
+    if (check_bp == bp)
+        check_bp = into;
+}
+
+/**
+ * coalesce - Merges free block @bp with its free neighbours and puts the
+ * result on its free list.
+ *
+ * @return the merged block.
+ */
+static void *coalesce(char *bp)
+{
+    size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
+    size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
+    size_t size = GET_SIZE(HDRP(bp));
+
+    if (!next_alloc) {
+        remove_free(NEXT_BLKP(bp));
+        absorb(bp, NEXT_BLKP(bp));
+        size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
+    }
+    if (!prev_alloc) {
+        remove_free(PREV_BLKP(bp));
+        absorb(PREV_BLKP(bp), bp);
+        size += GET_SIZE(HDRP(PREV_BLKP(bp)));
+        bp = PREV_BLKP(bp);
+    }
+    PUT(HDRP(bp), PACK(size, 0));
+    PUT(FTRP(bp), PACK(size, 0));
+    insert(bp);
+    return bp;
+}
+
+/* extend_heap - Extends the heap with a free block of @size bytes */
+static void *extend_heap(size_t size)
+{
+    char *bp;
+
+    size = ALIGN(size);
+    if ((long)(bp = mem_sbrk(size)) == -1)
+        return NULL;
+
+    /* Initialize free block header/footer and the epilogue header */
+    PUT(HDRP(bp), PACK(size, 0));           /* Free block header */
+    PUT(FTRP(bp), PACK(size, 0));           /* Free block footer */
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));   /* New epilogue header */
+
+    /* Coalesce if the previous block was free */
+    return coalesce(bp);
+}
+
+/**
+ * place - Allocates @asize bytes at the start of free block @bp, and
+ * splits the rest off if it makes a block.
+ */
+static void place(char *bp, size_t asize)
+{
+    size_t csize = GET_SIZE(HDRP(bp));
+
+    remove_free(bp);
+    if (csize - asize >= MINBLOCK) {
+        PUT(HDRP(bp), PACK(asize, 1));
+        PUT(FTRP(bp), PACK(asize, 1));
+        bp = NEXT_BLKP(bp);
+        PUT(HDRP(bp), PACK(csize - asize, 0));
+        PUT(FTRP(bp), PACK(csize - asize, 0));
+        insert(bp);
+    }
+    else {
+        PUT(HDRP(bp), PACK(csize, 1));
+        PUT(FTRP(bp), PACK(csize, 1));
+    }
+}
+
+/* find_fit - Returns the first free block of @asize bytes or more */
+static void *find_fit(size_t asize)
+{
+    char *bp;
+    int c;
+
+    for (c = class_of(asize); c < NCLASSES; c++)
+        for (bp = lists[c]; bp != NULL; bp = SUCC(bp))
+            if (GET_SIZE(HDRP(bp)) >= asize)
+                return bp;
+    return NULL;
+}
+
+
+/*****************************************************************************************
+ * Deferred coalescing.
+ *
+ * Blocks freed together are merged a run at a time: sorted by address,
+ * each run of neighbours, with the free blocks around it, becomes one free
+ * block with one pair of tags and one insertion in a free list.
+ * ***************************************************************************************/
+/* sort_blocks - Sorts the list of @n blocks at @list by address */
+static char *sort_blocks(char *list, long n)
+{
+    char *a, *b, *head, *last, *next;
+    long i;
+
+    if (n < 2)
+        return list;
+    for (a = list, i = 1; i < n / 2; i++)
+        a = QNEXT(a);
+    b = QNEXT(a);
+    SET_QNEXT(a, NULL);
+    a = sort_blocks(list, n / 2);
+    b = sort_blocks(b, n - n / 2);
+
+    for (head = last = NULL; a != NULL && b != NULL; last = next) {
+        if (a < b) {
+            next = a;
+            a = QNEXT(a);
+        }
+        else {
+            next = b;
+            b = QNEXT(b);
+        }
+        if (last == NULL)
+            head = next;
+        else
+            SET_QNEXT(last, next);
+    }
+    SET_QNEXT(last, a != NULL ? a : b);
+    return head;
+}
+
+/* free_blocks - Frees the list of allocated blocks at @list, sorted */
+static void free_blocks(char *list)
+{
+    char *bp, *next;
+    size_t size;
+
+    while ((bp = list) != NULL) {
+        list = QNEXT(bp);
+        size = GET_SIZE(HDRP(bp));
+
+        /* Take in the next blocks while they are freed too or free */
+        for (next = bp + size; ; next = bp + size) {
+            if (next == list)
+                list = QNEXT(next);
+            else if (!GET_ALLOC(HDRP(next)))
+                remove_free(next);
+            else
+                break;
+            absorb(bp, next);
+            size += GET_SIZE(HDRP(next));
+        }
+        PUT(HDRP(bp), PACK(size, 0));
+        PUT(FTRP(bp), PACK(size, 0));
+        coalesce(bp);
+    }
+}
+
+/* flush_quick - Coalesces every block on the quick lists */
+static void flush_quick(void)
+{
+    char *list = NULL, *bp;
+    int i;
+
+    for (i = 0; i <= QUICK_MAX / DSIZE; i++) {
+        while ((bp = quick[i]) != NULL) {
+            quick[i] = QNEXT(bp);
+            SET_QNEXT(bp, list);
+            list = bp;
+        }
+    }
+    free_blocks(sort_blocks(list, nquick));
+    quick_bytes = 0;
+    nquick = 0;
+}
+
+
+/*****************************************************************************************
+ * Blocks on huge page boundaries.
+ *
+ * A block of more than half a huge page gets its payload on a huge page
+ * boundary, so that it spans as few pages, and TLB entries, as it can: a
+ * block that fits in one huge page then takes one, not two. The free
+ * space before it is split off as a block of its own.
+ * ***************************************************************************************/
+/* gap - Returns how far past @bp the first aligned payload can start */
+static size_t gap(char *bp)
+{
+    size_t n = -(uintptr_t)bp & (huge - 1);
+
+    if (n > 0 && n < MINBLOCK)
+        n += huge;              /* The space before must be a block */
+    return n;
+}
+
+/**
+ * lead - Returns how far into free block @bp a block of @asize bytes with
+ * an aligned payload can start, or -1 if it does not fit.
+ */
+static long lead(char *bp, size_t asize)
+{
+    size_t n = gap(bp);
+
+    return n + asize <= GET_SIZE(HDRP(bp)) ? (long)n : -1;
+}
+
+static void *malloc_aligned(size_t asize)
+{
+    size_t csize;
+    char *bp = NULL;
+    long n = -1;
+    int c;
+
+    for (c = class_of(asize); c < NCLASSES && n < 0; c++)
+        for (bp = lists[c]; bp != NULL; bp = SUCC(bp))
+            if ((n = lead(bp, asize)) >= 0)
+                break;
+    if (n < 0 && nquick > 0) {
+        flush_quick();
+        return malloc_aligned(asize);
+    }
+    if (n < 0) {
+        /* The new block starts at the break, or before if it coalesces */
+        bp = extend_heap(gap((char *)mem_heap_hi() + 1) + asize);
+        if (bp == NULL)
+            return NULL;
+        n = lead(bp, asize);
+    }
+
+    if (n > 0) {
+        csize = GET_SIZE(HDRP(bp));
+        remove_free(bp);
+        PUT(HDRP(bp), PACK(n, 0));
+        PUT(FTRP(bp), PACK(n, 0));
+        insert(bp);
+        bp += n;
+        PUT(HDRP(bp), PACK(csize - n, 0));
+        PUT(FTRP(bp), PACK(csize - n, 0));
+        insert(bp);
+    }
+    place(bp, asize);
+    return bp;
+}
+
+
+/*****************************************************************************************
+ * The allocator.
+ * ***************************************************************************************/
+static void check_tick(void);
+
+int mm_init(void)
+{
+    /* Create the initial empty heap */
+    if ((heap_listp = mem_sbrk(4 * WSIZE)) == (void *)-1)
+        return -1;
+    PUT(heap_listp, 0);                             /* Alignment padding */
+    PUT(heap_listp + (1 * WSIZE), PACK(DSIZE, 1));  /* Prologue header */
+    PUT(heap_listp + (2 * WSIZE), PACK(DSIZE, 1));  /* Prologue footer */
+    PUT(heap_listp + (3 * WSIZE), PACK(0, 1));      /* Epilogue header */
+    heap_listp += (2 * WSIZE);
+
+    memset(lists, 0, sizeof(lists));
+    memset(quick, 0, sizeof(quick));
+    quick_bytes = 0;
+    nquick = 0;
+    check_bp = NULL;
+    check_countdown = check_calls;
+    huge = huge_align && mem_pagesize() > (size_t)getpagesize()
+        ? mem_pagesize() : 0;
+
+    /* Extend the empty heap with a free block of CHUNKSIZE bytes */
+    if (extend_heap(CHUNKSIZE) == NULL)
+        return -1;
+    return 0;
+}
+
+void *mm_malloc(size_t size)
+{
+    size_t asize;       /* Adjusted block size */
+    char *bp;
+
+    if (heap_listp == NULL)
+        mm_init();
+    check_tick();
+
+    /* Ignore spurious requests */
+    if (size == 0 || size > MAX_BLOCK)
+        return NULL;
+
+    /* Adjust block size to include overhead and alignment reqs. */
+    asize = MAX(ALIGN(size + DSIZE), MINBLOCK);
+    if (huge && asize > huge / 2)
+        return malloc_aligned(asize);
+
+    /* A block freed at the same size comes first */
+    if (asize <= QUICK_MAX && (bp = quick[asize / DSIZE]) != NULL) {
+        quick[asize / DSIZE] = QNEXT(bp);
+        quick_bytes -= asize;
+        nquick--;
+        return bp;
+    }
+
+    /* Search the free lists for a fit, then again with the quick lists
+       coalesced */
+    if ((bp = find_fit(asize)) == NULL && nquick > 0) {
+        flush_quick();
+        bp = find_fit(asize);
+    }
+    if (bp != NULL) {
+        place(bp, asize);
+        return bp;
+    }
+
+    /* No fit found. Get more memory and place the block */
+    if ((bp = extend_heap(MAX(asize, CHUNKSIZE))) == NULL)
+        return NULL;
+    place(bp, asize);
+    return bp;
+}
+
+void mm_free(void *ptr)
+{
+    size_t size;
+
+    if (ptr == NULL)
+        return;
+    check_tick();
+    size = GET_SIZE(HDRP(ptr));
+    if (size <= QUICK_MAX && quick_limit > 0) {
+        SET_QNEXT(ptr, quick[size / DSIZE]);
+        quick[size / DSIZE] = ptr;
+        quick_bytes += size;
+        nquick++;
+        if (quick_bytes > quick_limit)
+            flush_quick();
+        return;
+    }
+    PUT(HDRP(ptr), PACK(size, 0));
+    PUT(FTRP(ptr), PACK(size, 0));
+    coalesce(ptr);
+}
+
+void mm_free_batch(void **ptrs, size_t n)
+{
+    char *list = NULL;
+    long count = 0;
+    size_t i;
+
+    check_tick();
+    for (i = 0; i < n; i++) {
+        if (ptrs[i] != NULL) {
+            SET_QNEXT(ptrs[i], list);
+            list = ptrs[i];
+            count++;
+        }
+    }
+    free_blocks(sort_blocks(list, count));
+}
+
+void mm_defer(size_t limit)
+{
+    quick_limit = limit;
+    if (quick_bytes > quick_limit)
+        flush_quick();
+}
+
+void mm_huge_align(int on)
+{
+    huge_align = on;
+}
+
+void mm_trace(char *path)
+{
+    if (tracing)
+        trace_close();
+    if ((tracing = path != NULL))
+        trace_open(path);
+}
+
+void *mm_realloc(void *ptr, size_t size)
+{
+    size_t asize, oldsize, total;
+    char *next, *newptr;
+
+    if (ptr == NULL)
+        return mm_malloc(size);
+    if (size == 0) {
+        mm_free(ptr);
+        return NULL;
+    }
+    if (size > MAX_BLOCK)
+        return NULL;
+    check_tick();
+    asize = MAX(ALIGN(size + DSIZE), MINBLOCK);
+    oldsize = GET_SIZE(HDRP(ptr));
+
+    /* Shrinking, or growing into a free next block, is done in place */
+    next = NEXT_BLKP(ptr);
+    total = oldsize;
+    if (asize > oldsize && !GET_ALLOC(HDRP(next))) {
+        total += GET_SIZE(HDRP(next));
+        if (total >= asize) {
+            remove_free(next);
+            absorb(ptr, next);
+        }
+    }
+    if (total >= asize) {
+        if (total - asize >= MINBLOCK) {
+            PUT(HDRP(ptr), PACK(asize, 1));
+            PUT(FTRP(ptr), PACK(asize, 1));
+            next = NEXT_BLKP(ptr);
+            PUT(HDRP(next), PACK(total - asize, 0));
+            PUT(FTRP(next), PACK(total - asize, 0));
+            coalesce(next);
+        }
+        else {
+            PUT(HDRP(ptr), PACK(total, 1));
+            PUT(FTRP(ptr), PACK(total, 1));
+        }
+        return ptr;
+    }
+
+    if ((newptr = mm_malloc(size)) == NULL)
+        return NULL;
+    memcpy(newptr, ptr, oldsize - DSIZE);
+    mm_free(ptr);
+    return newptr;
+}
+
+
+/*****************************************************************************************
+ * Heap consistency checker.
+ * ***************************************************************************************/
+/* check_error - Prints an error about block @bp, returns 1 */
+static int check_error(void *bp, char *msg)
+{
+    fprintf(stderr, "mm: block %p: %s\n", bp, msg);
+    return 1;
+}
+
+static void printblock(void *bp)
+{
+    size_t hsize = GET_SIZE(HDRP(bp)), halloc = GET_ALLOC(HDRP(bp));
+
+    if (hsize == 0) {
+        printf("%p: EOL\n", bp);
+        return;
+    }
+    printf("%p: header: [%zu:%c] footer: [%zu:%c]\n", bp, hsize,
+           (halloc ? 'a' : 'f'), GET_SIZE(FTRP(bp)),
+           (GET_ALLOC(FTRP(bp)) ? 'a' : 'f'));
+}
+
+/* checkblock - Checks the tags and alignment of block @bp */
+static int checkblock(void *bp)
+{
+    int errors = 0;
+
+    if ((uintptr_t)bp % DSIZE)
+        errors += check_error(bp, "payload not aligned");
+    if (GET(HDRP(bp)) != GET(FTRP(bp)))
+        errors += check_error(bp, "header does not match footer");
+    if (GET_SIZE(HDRP(bp)) < MINBLOCK)
+        errors += check_error(bp, "smaller than the minimum block");
+    return errors;
+}
+
+/* in_heap - Returns 1 if @p points into the heap */
+static int in_heap(void *p)
+{
+    return p >= mem_heap_lo() && p <= mem_heap_hi();
+}
+
+/* checksize - Checks that block @bp ends in the heap, so it can be read */
+static int checksize(void *bp)
+{
+    if (HDRP(bp) + GET_SIZE(HDRP(bp)) > (char *)mem_heap_hi() + 1 - WSIZE)
+        return check_error(bp, "size runs past the heap");
+    return 0;
+}
+
+/**
+ * checkfree - Checks that free block @bp has an allocated next block, and
+ * is linked to from the blocks it links to on its free list.
+ */
+static int checkfree(char *bp)
+{
+    int errors = 0;
+
+    if (!GET_ALLOC(HDRP(NEXT_BLKP(bp))))
+        errors += check_error(bp, "two free blocks in a row");
+    if (PRED(bp) == NULL ? lists[class_of(GET_SIZE(HDRP(bp)))] != bp
+        : !in_heap(PRED(bp)) || SUCC(PRED(bp)) != bp)
+        errors += check_error(bp, "free list link before does not match");
+    if (SUCC(bp) != NULL && (!in_heap(SUCC(bp)) || PRED(SUCC(bp)) != bp))
+        errors += check_error(bp, "free list link after does not match");
+    return errors;
+}
+
+/* checklists - Checks the quick and free lists, returns the errors and @nfree */
+static int checklists(long *nfree)
+{
+    char *bp;
+    long left = nquick;
+    size_t bytes = quick_bytes;
+    int c, errors = 0;
+
+    *nfree = 0;
+    for (c = 0; c <= QUICK_MAX / DSIZE; c++) {
+        for (bp = quick[c]; bp != NULL; bp = QNEXT(bp)) {
+            if (!in_heap(bp))
+                return errors + check_error(bp, "quick list link out of heap");
+            if (!GET_ALLOC(HDRP(bp)) || GET_SIZE(HDRP(bp)) != c * DSIZE)
+                errors += check_error(bp, "bad block on a quick list");
+            left--;
+            bytes -= GET_SIZE(HDRP(bp));
+        }
+    }
+    if (left != 0 || bytes != 0)
+        errors += check_error(heap_listp, "quick list counts do not match");
+
+    for (c = 0; c < NCLASSES; c++) {
+        for (bp = lists[c]; bp != NULL; bp = SUCC(bp)) {
+            if (!in_heap(bp))
+                return errors + check_error(bp, "free list link out of heap");
+            if (GET_ALLOC(HDRP(bp)))
+                errors += check_error(bp, "allocated block on a free list");
+            if (class_of(GET_SIZE(HDRP(bp))) != c)
+                errors += check_error(bp, "free block on the wrong list");
+            (*nfree)++;
+        }
+    }
+    return errors;
+}
+
+int mm_checkheap(int verbose)
+{
+    char *bp = heap_listp;
+    long nfree = 0, listed;
+    int errors = 0;
+
+    if (verbose)
+        printf("Heap (%p):\n", heap_listp);
+    if (GET_SIZE(HDRP(heap_listp)) != DSIZE || !GET_ALLOC(HDRP(heap_listp)))
+        errors += check_error(heap_listp, "bad prologue header");
+
+    for (bp = NEXT_BLKP(heap_listp); GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+        if (checksize(bp))
+            return errors + 1;
+        if (verbose)
+            printblock(bp);
+        errors += checkblock(bp);
+        if (!GET_ALLOC(HDRP(bp))) {
+            errors += checkfree(bp);
+            nfree++;
+        }
+    }
+
+    if (verbose)
+        printblock(bp);
+    if (!GET_ALLOC(HDRP(bp)) || HDRP(bp) != (char *)mem_heap_hi() + 1 - WSIZE)
+        errors += check_error(bp, "bad epilogue header");
+
+    errors += checklists(&listed);
+    if (listed != nfree)
+        errors += check_error(heap_listp, "free blocks missing from the lists");
+    return errors;
+}
+
+int mm_checkslice(int blocks)
+{
+    char *bp = check_bp != NULL ? check_bp : NEXT_BLKP(heap_listp);
+    int errors = 0;
+
+    for (; blocks > 0; blocks--) {
+        if (GET_SIZE(HDRP(bp)) == 0) {
+            if (!GET_ALLOC(HDRP(bp)) || HDRP(bp) != (char *)mem_heap_hi() + 1 - WSIZE)
+                errors += check_error(bp, "bad epilogue header");
+            bp = NEXT_BLKP(heap_listp);
+            continue;
+        }
+        if (!in_heap(bp) || checksize(bp)) {
+            check_bp = NULL;        /* Cannot go on from here */
+            return errors + 1;
+        }
+        errors += checkblock(bp);
+        if (!GET_ALLOC(HDRP(bp)))
+            errors += checkfree(bp);
+        bp = NEXT_BLKP(bp);
+    }
+    check_bp = bp;
+    return errors;
+}
+
+void mm_check_every(int calls, int blocks)
+{
+    check_calls = calls;
+    check_blocks = blocks;
+    check_countdown = calls;
+}
+
+/* check_tick - Counts an allocator call, checking a slice when it is due */
+static void check_tick(void)
+{
+    if (check_calls > 0 && --check_countdown <= 0) {
+        check_countdown = check_calls;
+        if (mm_checkslice(check_blocks) != 0)
+            app_error("mm: heap corrupted");
+    }
+}
+
+
+/*****************************************************************************************
+ * Heap dumps and snapshots.
+ * ***************************************************************************************/
+static int compare_blocks(const void *a, const void *b)
+{
+    char *x = *(char **)a, *y = *(char **)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* dump_class - Returns the histogram class of a block of @size bytes */
+static int dump_class(size_t size)
+{
+    int c = 63 - __builtin_clzl(size);
+
+    return c < MM_DUMP_CLASSES ? c : MM_DUMP_CLASSES - 1;
+}
+
+/**
+ * dump - Writes the dump of the heap to @fd, its stats to @stats if not
+ * NULL. It does not exit on an error: a snapshot child must _exit, not
+ * run the atexit handlers and flush the stdio buffers of its parent.
+ *
+ * @return 0, or -1 on error with errno set.
+ */
+static int dump(int fd, mm_stats_t *stats)
+{
+    uint64_t buf[DUMP_BUF];
+    char **quicks, *bp;
+    mm_stats_t st;
+    long i = 0, q = 0;
+    int c, n = 0;
+    size_t size;
+
+    /* The quick blocks, in address order, to be told from allocated ones */
+    if ((quicks = malloc((nquick + 1) * sizeof(char *))) == NULL)
+        return -1;
+    for (c = 0; c <= QUICK_MAX / DSIZE; c++)
+        for (bp = quick[c]; bp != NULL; bp = QNEXT(bp))
+            quicks[q++] = bp;
+    qsort(quicks, q, sizeof(char *), compare_blocks);
+
+    memset(&st, 0, sizeof(st));
+    memcpy(&buf[n++], MM_DUMP_MAGIC, 8);
+    buf[n++] = (uintptr_t)NEXT_BLKP(heap_listp);
+    for (bp = NEXT_BLKP(heap_listp); ; bp = NEXT_BLKP(bp)) {
+        if ((size = GET_SIZE(HDRP(bp))) == 0) {
+            buf[n++] = GET(HDRP(bp));
+            break;
+        }
+        if (i < q && quicks[i] == bp) {
+            buf[n++] = size | MM_DUMP_QUICK;
+            i++;
+        }
+        else
+            buf[n++] = size | GET_ALLOC(HDRP(bp));
+
+        if (buf[n - 1] & MM_DUMP_ALLOC) {
+            st.live_blocks++;
+            st.live_bytes += size - DSIZE;
+            st.live_hist[dump_class(size)]++;
+        }
+        else {
+            st.free_blocks++;
+            st.free_bytes += size;
+            st.free_hist[dump_class(size)]++;
+            if (size > st.largest_free)
+                st.largest_free = size;
+        }
+        if (n == DUMP_BUF) {
+            if (rio_writen(fd, buf, sizeof(buf)) < 0)
+                goto fail;
+            n = 0;
+        }
+    }
+    st.heap_size = mem_heapsize();
+    if (rio_writen(fd, buf, n * sizeof(uint64_t)) < 0 ||
+        rio_writen(fd, &st, sizeof(st)) < 0)
+        goto fail;
+
+    free(quicks);
+    if (stats != NULL)
+        *stats = st;
+    return 0;
+
+fail:
+    free(quicks);
+    return -1;
+}
+
+void mm_dump(int fd, mm_stats_t *stats)
+{
+    if (dump(fd, stats) < 0)
+        unix_error("mm_dump error");
+}
+
+/**
+ * private_kb - Returns the private memory of the mapping of @addr, the
+ * pages no other process shares, in KB.
+ */
+static long private_kb(void *addr)
+{
+    unsigned long start, end;
+    char line[256];
+    long kb, total = 0;
+    int in = 0;
+    FILE *fp;
+
+    if ((fp = fopen("/proc/self/smaps", "r")) == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2)
+            in = start <= (uintptr_t)addr && (uintptr_t)addr < end;
+        else if (in && (sscanf(line, "Private_Clean: %ld kB", &kb) == 1 ||
+                        sscanf(line, "Private_Dirty: %ld kB", &kb) == 1))
+            total += kb;
+    }
+    fclose(fp);
+    return total;
+}
+
+void mm_snapshot(mm_snapshot_t *s, int fd)
+{
+    s->shm = shm_create(sizeof(long));
+    s->cow_kb = shm_alloc(s->shm, sizeof(long));
+    *s->cow_kb = -1;
+    s->copied_kb = -1;
+
+    if (child_fork(&s->child) == 0) {
+        if (dump(fd, NULL) < 0)
+            _exit(1);           /* cow_kb stays -1 */
+
+        /* Whatever the child no longer shares was copied for a write */
+        *s->cow_kb = private_kb(mem_heap_lo());
+        _exit(0);               /* Not exit, which flushes the parent's stdio */
+    }
+}
+
+int mm_snapshot_wait(mm_snapshot_t *s, int timeout)
+{
+    if (!child_wait(&s->child, timeout))
+        return 0;
+    s->copied_kb = *s->cow_kb;
+    child_close(&s->child);
+    shm_destroy(s->shm);
+    return 1;
+}
@@ -0,0 +1,162 @@
+/*****************************************************************************************
+ * mm.h - A dynamic storage allocator on top of memlib's heap.
+ *
+ * Blocks have boundary tags and free blocks are kept on segregated
+ * explicit free lists, one per power-of-two size class. A request is
+ * served by the first fit of its class, or of the next non-empty one, and
+ * freed blocks are coalesced with their free neighbours at once. Payloads
+ * are aligned to 16 bytes, and when the heap is on huge pages, blocks of
+ * more than half a huge page start on a huge page boundary, so they use
+ * as few TLB entries as they can. Coalescing can be deferred for small
+ * blocks, which are then reused as they are by requests of their size.
+ *
+ * The heap can be dumped, or snapshotted: a forked child, which sees the
+ * heap as it was at the fork, copy-on-write, dumps it while the caller
+ * goes on allocating.
+ ****************************************************************************************/
+#ifndef __MM_H__
+#define __MM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+
+/*
+ * A heap dump is the 8 bytes MM_DUMP_MAGIC and the payload address of the
+ * first block, then the block map: the header word of each block in address
+ * order, its size with MM_DUMP_ALLOC set if it is allocated, MM_DUMP_QUICK
+ * if it waits on a quick list, ending with a word of size 0. The mm_stats_t
+ * of the heap comes last. Words are 64 bits, in host byte order.
+ */
+#define MM_DUMP_MAGIC "mmdump01"
+#define MM_DUMP_ALLOC (1)
+#define MM_DUMP_QUICK (2)
+#define MM_DUMP_SIZE(word) ((word) & ~(uint64_t)15)
+#define MM_DUMP_CLASSES (32)
+
+typedef struct {
+    uint64_t heap_size;                     /* Bytes */
+    uint64_t live_blocks, live_bytes;       /* Allocated, and their payload */
+    uint64_t free_blocks, free_bytes;       /* Free or on a quick list */
+    uint64_t largest_free;                  /* Bytes of the largest */
+    uint64_t live_hist[MM_DUMP_CLASSES];    /* Allocated of [2^i, 2^(i+1)) */
+    uint64_t free_hist[MM_DUMP_CLASSES];    /* Free of [2^i, 2^(i+1)) bytes */
+} mm_stats_t;
+
+/* A snapshot of the heap, dumped by a child process */
+typedef struct {
+    child_t child;      /* The child; its pidfd is readable once it is done */
+    shm_t *shm;         /* Where the child leaves its cost */
+    long *cow_kb;       /* In shm */
+    long copied_kb;     /* Heap copied on write, KB, -1 if the dump failed */
+} mm_snapshot_t;
+
+/**
+ * mm_init - Initializes the allocator on memlib's heap, which must have
+ * been set up with mem_init or mem_init_pages.
+ *
+ * @return 0, or -1 if the heap is too small.
+ */
+int mm_init(void);
+
+/**
+ * mm_malloc - Allocates a block of at least @size bytes.
+ *
+ * @return its payload, aligned to 16 bytes, or NULL if @size is 0 or the
+ * heap is full.
+ */
+void *mm_malloc(size_t size);
+
+/**
+ * mm_free - Frees the block of @ptr, which mm_malloc or mm_realloc
+ * returned. Does nothing if @ptr is NULL.
+ */
+void mm_free(void *ptr);
+
+/**
+ * mm_free_batch - Frees the @n blocks of @ptrs, skipping NULLs, in one
+ * pass over them in address order that merges each run of neighbours at
+ * once. The blocks are linked through their payloads to be sorted, so
+ * @ptrs is left as it is.
+ */
+void mm_free_batch(void **ptrs, size_t n);
+
+/**
+ * mm_defer - Lets up to @limit bytes of freed small blocks wait on quick
+ * lists, by size, instead of being coalesced; they are coalesced all
+ * together when a request finds no other fit or the limit is passed. 0,
+ * the default, coalesces each block as it is freed. The limit bounds the
+ * memory the heap can lose to blocks too small to be reused.
+ */
+void mm_defer(size_t limit);
+
+/**
+ * mm_huge_align - Turns the huge page alignment of large blocks on or off,
+ * from the next mm_init on. It is on by default.
+ */
+void mm_huge_align(int on);
+
+/**
+ * mm_trace - Writes every read and write of a block tag or a free list
+ * link to the trace @path (see trace.h), until mm_trace(NULL) closes it.
+ */
+void mm_trace(char *path);
+
+/**
+ * mm_realloc - Resizes the block of @ptr to @size bytes, in place when it
+ * can, keeping its content. Like mm_malloc if @ptr is NULL, mm_free if
+ * @size is 0.
+ */
+void *mm_realloc(void *ptr, size_t size);
+
+/**
+ * mm_checkheap - Checks every block and free list of the heap. Prints
+ * each block as well if @verbose.
+ *
+ * @return the number of errors found, each printed to stderr.
+ */
+int mm_checkheap(int verbose);
+
+/**
+ * mm_checkslice - Checks the next @blocks blocks of the heap from a cursor
+ * that goes round it, from where the last call stopped: their tags, their
+ * free list links, and that no two free blocks are neighbours. Each call
+ * costs only its own slice.
+ *
+ * @return the number of errors found, each printed to stderr.
+ */
+int mm_checkslice(int blocks);
+
+/**
+ * mm_check_every - Runs mm_checkslice(@blocks) every @calls calls to the
+ * allocator, and exits at the first error; 0 calls, the default, turns it
+ * off. A heap of H blocks is gone over every H * @calls / @blocks calls,
+ * at a cost per call that grows with @blocks / @calls.
+ */
+void mm_check_every(int calls, int blocks);
+
+/**
+ * mm_dump - Writes a dump of the heap to @fd, and its summary to @stats
+ * unless it is NULL.
+ */
+void mm_dump(int fd, mm_stats_t *stats);
+
+/**
+ * mm_snapshot - Forks a child that dumps the heap, as it is now, to @fd,
+ * and returns at once. The parent and the child share the pages of the
+ * heap until either writes to one, which then gets copied: the cost of
+ * the snapshot.
+ */
+void mm_snapshot(mm_snapshot_t *s, int fd);
+
+/**
+ * mm_snapshot_wait - Waits at most @timeout milliseconds (0 = just check,
+ * -1 = forever) for the child of @s to be done, and reaps it. Then
+ * s->copied_kb is the memory of the heap that was copied on write while
+ * the child ran, or -1 if the dump failed.
+ *
+ * @return 1 if the child was reaped, 0 on timeout.
+ */
+int mm_snapshot_wait(mm_snapshot_t *s, int timeout);
+
+#endif /* __MM_H__ */
@@ -0,0 +1,168 @@
+#include "common.h"
+#include "memlib.h"
+#include "mm.h"
+#include "vmsim.h"
+
+/**
+ * mmbench - How the pages backing the heap affect the TLB. N blocks of 16
+ * to 512 bytes and L blocks of just under 2 MB are taken from mm_malloc
+ * and written, then K random bytes of them are read, every other one from
+ * a large block, on a heap of
+ *
+ *   4K          base pages
+ *   THP         transparent huge pages, with mm_huge_align off: a large
+ *               block mostly straddles two huge pages
+ *   THP 2M      the same, with large blocks on 2 MB boundaries, each in
+ *               a huge page of its own
+ *
+ * For each it reports the time per read, the pages a large block spans on
+ * average, the anonymous huge pages the kernel gave the heap, and the TLB
+ * miss rate and page table entries read
+ * per access of the same reads in the default TLB of vmsim.h. With -P the
+ * performance counters of the reads are printed too, with the dTLB misses
+ * when the CPU has them.
+ *
+ * usage: mmbench [-P] [-n N] [-l L] [-k K]
+ *                (default: 16384 small and 6 large blocks, 4000000 reads)
+ */
+#define LARGE ((1 << 21) - 64)   /* A block fits in a huge page */
+
+static char **addrs;            /* The bytes to read */
+static volatile long sink;      /* Keeps the reads */
+
+/* anon_huge_kb - Returns the AnonHugePages of the mapping of @addr */
+static long anon_huge_kb(void *addr)
+{
+    unsigned long start, end;
+    char line[256];
+    int in = 0;
+    long kb = 0;
+    FILE *fp;
+
+    if ((fp = fopen("/proc/self/smaps", "r")) == NULL)
+        return -1;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2)
+            in = start <= (uintptr_t)addr && (uintptr_t)addr < end;
+        else if (in && sscanf(line, "AnonHugePages: %ld kB", &kb) == 1)
+            break;
+    }
+    fclose(fp);
+    return kb;
+}
+
+static void run(char *name, int pages, int align, int n, int l, long k)
+{
+    vm_config_t config = VM_CONFIG_DEFAULT;
+    char **small, **large;
+    int i, *sizes, errors;
+    double start, t;
+    long j, spans = 0, sum = 0;
+    vm_stats_t before, *s;
+
+    pages = mem_init_pages(pages);
+    config.thp = pages != MEM_SMALL_PAGES;
+    vm_init(&config);
+    mm_huge_align(align);
+    if (mm_init() < 0)
+        app_error("mmbench: mm_init failed");
+    small = Malloc(n * sizeof(char *));
+    sizes = Malloc(n * sizeof(int));
+    large = Malloc(l * sizeof(char *));
+    srand(1);
+
+    /* Interleave the large blocks with the small ones */
+    for (i = 0; i < n; i++) {
+        sizes[i] = 16 + rand() % 497;
+        if ((small[i] = mm_malloc(sizes[i])) == NULL)
+            app_error("mmbench: out of heap");
+        memset(small[i], i, sizes[i]);
+        if (i % (n / l + 1) == 0 && i / (n / l + 1) < l) {
+            if ((large[i / (n / l + 1)] = mm_malloc(LARGE)) == NULL)
+                app_error("mmbench: out of heap");
+            memset(large[i / (n / l + 1)], i, LARGE);
+        }
+    }
+    for (i = 0; i < l; i++) {
+        if (align && pages != MEM_SMALL_PAGES &&
+            ((uintptr_t)large[i] & (mem_pagesize() - 1)) != 0)
+            app_error("mmbench: large block not on a huge page boundary");
+        spans += ((uintptr_t)large[i] + LARGE - 1) / mem_pagesize()
+            - (uintptr_t)large[i] / mem_pagesize() + 1;
+    }
+    for (j = 0; j < k; j++) {
+        i = rand();
+        addrs[j] = j % 2 ? large[i % l] + rand() % LARGE
+                         : small[i % n] + rand() % sizes[i % n];
+    }
+
+    PERF_BEGIN(name);
+    start = clock_now();
+    for (j = 0; j < k; j++)
+        sum += *addrs[j];
+    t = clock_now() - start;
+    PERF_END(name);
+
+    /* The same reads, translated by the model */
+    sink = sum;
+    before = *vm_stats();
+    for (j = 0; j < k; j++)
+        vm_access((uintptr_t)addrs[j]);
+    s = vm_stats();
+
+    printf("%-6s %10.2f %11.2f %12ld %10.2f %12.2f", name, t * 1e9 / k,
+           (double)spans / l, anon_huge_kb(mem_heap_lo()),
+           100.0 * (s->walks - before.walks) / k,
+           (double)(s->walk_refs - before.walk_refs) / k);
+    if ((errors = mm_checkheap(0)) != 0)
+        printf("   %d heap errors", errors);
+    printf("\n");
+
+    Free(small);
+    Free(sizes);
+    Free(large);
+    vm_free();
+    mem_deinit();
+}
+
+int main(int argc, char **argv)
+{
+    int c, pflag = 0, n = 16384, l = 6;
+    long k = 4000000;
+
+    while ((c = getopt(argc, argv, "Pn:l:k:")) != -1) {
+        switch (c) {
+            case 'P':
+                pflag = 1;
+                break;
+            case 'n':
+                n = atoi(optarg);
+                break;
+            case 'l':
+                l = atoi(optarg);
+                break;
+            case 'k':
+                k = atol(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-P] [-n N] [-l L] [-k K]\n",
+                        argv[0]);
+                exit(1);
+        }
+    }
+    if (n <= 0 || l <= 0 || k <= 0)
+        app_error("mmbench: N, L and K must be positive");
+
+    perf_open(0);
+    addrs = Malloc(k * sizeof(char *));
+    printf("%d blocks of 16-512 bytes, %d of 2 MB, %ld reads\n", n, l, k);
+    printf("%-6s %10s %11s %12s %10s %12s\n", "pages", "ns/read",
+           "pages/large", "AnonHuge kB", "TLB miss%", "reads/access");
+    run("4K", MEM_SMALL_PAGES, 1, n, l, k);
+    run("THP", MEM_THP, 0, n, l, k);
+    run("THP 2M", MEM_THP, 1, n, l, k);
+    if (pflag)
+        perf_report(stdout);
+    Free(addrs);
+    return 0;
+}
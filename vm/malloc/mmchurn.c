@@ -0,0 +1,147 @@
+#include "common.h"
+#include "memlib.h"
+#include "mm.h"
+
+/**
+ * mmchurn - Allocator throughput under churn. N blocks are kept live; each
+ * of K steps frees one at random and allocates another, of a size of a
+ * few common ones 4 times in 5, else of 1 to 1000 bytes. The same steps
+ * are run with
+ *
+ *   immediate   each block coalesced as it is freed
+ *   defer 4K    up to 4 KB of freed blocks waiting on quick lists
+ *   defer 64K   up to 64 KB
+ *   batch       frees gathered B at a time for mm_free_batch
+ *
+ * and for each it reports the steps per second, the heap size, and the
+ * utilization: the most payload live at once over the heap size, then
+ * the performance counters of the steps of each. With -c
+ * the allocator checks S blocks of the heap every C calls. With -w the
+ * allocator's references to block tags and free list links during the
+ * steps of the immediate run are written to the trace file F, for csim;
+ * that run is slowed down by it.
+ *
+ * usage: mmchurn [-n N] [-k K] [-b B] [-c C,S] [-w F]
+ *                (default: 10000 live blocks, 4000000 steps, batches of 64)
+ */
+static size_t common[] = {16, 24, 32, 48, 64, 96, 128, 256};
+
+static int *slots;              /* The block freed by each step */
+static size_t *sizes;           /* The size allocated by each step */
+static int check_calls, check_blocks;
+
+static void run(char *name, size_t limit, int batch, int n, long k,
+                char *trace)
+{
+    size_t *live_sizes = Malloc(n * sizeof(size_t));
+    void **live = Malloc(n * sizeof(void *));
+    void **pending = Malloc(batch * sizeof(void *));
+    size_t live_bytes = 0, peak = 0;
+    int i, npending = 0;
+    double start, t;
+    long j;
+
+    mem_init();
+    mm_init();
+    mm_defer(limit);
+    mm_check_every(check_calls, check_blocks);
+    for (i = 0; i < n; i++) {
+        live_sizes[i] = sizes[i];
+        if ((live[i] = mm_malloc(sizes[i])) == NULL)
+            app_error("mmchurn: out of heap");
+        live_bytes += sizes[i];
+    }
+
+    if (trace != NULL)
+        mm_trace(trace);
+    PERF_BEGIN(name);
+    start = clock_now();
+    for (j = 0; j < k; j++) {
+        i = slots[j];
+        live_bytes -= live_sizes[i];
+        if (batch) {
+            pending[npending++] = live[i];
+            if (npending == batch) {
+                mm_free_batch(pending, npending);
+                npending = 0;
+            }
+        }
+        else
+            mm_free(live[i]);
+        live_sizes[i] = sizes[j];
+        if ((live[i] = mm_malloc(sizes[j])) == NULL)
+            app_error("mmchurn: out of heap");
+        live_bytes += sizes[j];
+        if (live_bytes > peak)
+            peak = live_bytes;
+    }
+    t = clock_now() - start;
+    PERF_END(name);
+    if (trace != NULL)
+        mm_trace(NULL);
+
+    printf("%-10s %12.0f %12zu %8.1f", name, k / t, mem_heapsize(),
+           100.0 * peak / mem_heapsize());
+    if ((i = mm_checkheap(0)) != 0)
+        printf("   %d heap errors", i);
+    printf("\n");
+    mm_defer(0);
+    mem_deinit();
+    Free(live_sizes);
+    Free(live);
+    Free(pending);
+}
+
+int main(int argc, char **argv)
+{
+    int c, n = 10000, b = 64;
+    char *trace = NULL;
+    long j, k = 4000000;
+
+    while ((c = getopt(argc, argv, "n:k:b:c:w:")) != -1) {
+        switch (c) {
+            case 'n':
+                n = atoi(optarg);
+                break;
+            case 'k':
+                k = atol(optarg);
+                break;
+            case 'b':
+                b = atoi(optarg);
+                break;
+            case 'c':
+                if (sscanf(optarg, "%d,%d", &check_calls, &check_blocks) != 2)
+                    app_error("mmchurn: -c takes C,S");
+                break;
+            case 'w':
+                trace = optarg;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-n N] [-k K] [-b B] [-c C,S] "
+                        "[-w F]\n", argv[0]);
+                exit(1);
+        }
+    }
+    if (n <= 0 || k < n || b <= 0)
+        app_error("mmchurn: N and B must be positive, K at least N");
+
+    perf_open(0);
+    slots = Malloc(k * sizeof(int));
+    sizes = Malloc(k * sizeof(size_t));
+    srand(1);
+    for (j = 0; j < k; j++) {
+        slots[j] = rand() % n;
+        sizes[j] = rand() % 5 ? common[rand() % 8] : 1 + rand() % 1000;
+    }
+
+    printf("%d live blocks, %ld steps\n", n, k);
+    printf("%-10s %12s %12s %8s\n", "mode", "steps/s", "heap bytes", "util%");
+    run("immediate", 0, 0, n, k, trace);
+    run("defer 4K", 4096, 0, n, k, NULL);
+    run("defer 64K", 65536, 0, n, k, NULL);
+    run("batch", 0, b, n, k, NULL);
+    perf_report(stdout);
+    Free(slots);
+    Free(sizes);
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include "common.h"
+#include <inttypes.h>
+#include "mm.h"
+
+/**
+ * mmdump - Prints a heap dump written by mm_dump or mm_snapshot (see
+ * mm.h): the blocks live and free, the utilization, the fragmentation of
+ * the free memory (how much of it is not in the largest free block), and
+ * the blocks of each size class. -m prints the block map as well.
+ *
+ * usage: mmdump [-m] [dumpfile]        (default: standard input)
+ */
+
+/* read_word - Reads the next word of the dump, exits at its end */
+static uint64_t read_word(FILE *fp)
+{
+    uint64_t word;
+
+    if (fread(&word, sizeof(word), 1, fp) != 1)
+        app_error("mmdump: truncated dump");
+    return word;
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t word, addr, blocks = 0;
+    int c, i, mflag = 0;
+    char magic[8];
+    mm_stats_t st;
+    FILE *fp = stdin;
+
+    while ((c = getopt(argc, argv, "m")) != -1) {
+        switch (c) {
+            case 'm':
+                mflag = 1;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-m] [dumpfile]\n", argv[0]);
+                exit(1);
+        }
+    }
+    if (optind < argc && (fp = fopen(argv[optind], "r")) == NULL)
+        unix_error("mmdump: fopen error");
+
+    if (fread(magic, 8, 1, fp) != 1 || memcmp(magic, MM_DUMP_MAGIC, 8) != 0)
+        app_error("mmdump: not a heap dump");
+    addr = read_word(fp);
+    while (MM_DUMP_SIZE(word = read_word(fp)) != 0) {
+        if (mflag)
+            printf("%#14" PRIx64 " %10" PRIu64 " %s\n", addr,
+                   MM_DUMP_SIZE(word), word & MM_DUMP_ALLOC ? "allocated"
+                   : word & MM_DUMP_QUICK ? "quick" : "free");
+        addr += MM_DUMP_SIZE(word);
+        blocks++;
+    }
+    if (fread(&st, sizeof(st), 1, fp) != 1)
+        app_error("mmdump: truncated dump");
+
+    printf("heap      %10" PRIu64 " bytes in %" PRIu64 " blocks\n",
+           st.heap_size, blocks);
+    printf("live      %10" PRIu64 " bytes in %" PRIu64 " blocks, %.1f%% "
+           "utilization\n", st.live_bytes, st.live_blocks,
+           st.heap_size ? 100.0 * st.live_bytes / st.heap_size : 0.0);
+    printf("free      %10" PRIu64 " bytes in %" PRIu64 " blocks, largest %"
+           PRIu64 ", %.1f%% fragmentation\n", st.free_bytes, st.free_blocks,
+           st.largest_free, st.free_bytes ?
+           100.0 * (st.free_bytes - st.largest_free) / st.free_bytes : 0.0);
+    printf("%-20s %10s %10s\n", "block size", "live", "free");
+    for (i = 0; i < MM_DUMP_CLASSES; i++)
+        if (st.live_hist[i] || st.free_hist[i])
+            printf("[%8lu, %8lu) %10" PRIu64 " %10" PRIu64 "\n", 1UL << i,
+                   2UL << i, st.live_hist[i], st.free_hist[i]);
+    if (fp != stdin)
+        fclose(fp);
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include "common.h"
+#include "memlib.h"
+#include "mm.h"
+
+/**
+ * mmsnap - What a heap dump costs the program. A heap of N live blocks
+ * of 16 to 512 bytes is dumped to a file
+ *
+ *   in place    by mm_dump: the program stops for the whole dump
+ *   snapshot    by mm_snapshot: the program stops for the fork, then
+ *               frees and allocates a block at random, as fast as it can,
+ *               while the child dumps the heap, and reaps it when done
+ *
+ * and it reports how long the program was stopped, how many allocations
+ * it did during the dump, and the heap memory copied on write for them,
+ * then the performance counters of the program, not of the child, for
+ * each. Read the dump with mmdump.
+ *
+ * usage: mmsnap [-n N] dumpfile        (default: 50000 blocks)
+ */
+#define CHECK_STEPS (256)       /* Steps between looks at the child */
+
+int main(int argc, char **argv)
+{
+    int c, fd, n = 50000;
+    double start, t_dump, t_fork, t_snap;
+    mm_snapshot_t snap;
+    mm_stats_t stats;
+    long i, steps = 0;
+    char **live;
+
+    while ((c = getopt(argc, argv, "n:")) != -1) {
+        switch (c) {
+            case 'n':
+                n = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-n N] dumpfile\n", argv[0]);
+                exit(1);
+        }
+    }
+    if (optind != argc - 1 || n <= 0)
+        app_error("usage: mmsnap [-n N] dumpfile");
+
+    perf_open(0);
+    mem_init();
+    mm_init();
+    live = Malloc(n * sizeof(char *));
+    srand(1);
+    for (i = 0; i < n; i++) {
+        if ((live[i] = mm_malloc(16 + rand() % 497)) == NULL)
+            app_error("mmsnap: out of heap");
+        memset(live[i], 0, 16);
+    }
+
+    fd = Open(argv[optind], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    PERF_BEGIN("in place");
+    start = clock_now();
+    mm_dump(fd, &stats);
+    t_dump = clock_now() - start;
+    PERF_END("in place");
+    Close(fd);
+    printf("heap of %lu bytes, %lu live blocks\n",
+           (unsigned long)stats.heap_size, (unsigned long)stats.live_blocks);
+    printf("in place  stopped %8.3f ms\n", t_dump * 1e3);
+
+    fd = Open(argv[optind], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    PERF_BEGIN("snapshot");
+    start = clock_now();
+    mm_snapshot(&snap, fd);
+    t_fork = clock_now() - start;
+    Close(fd);
+    do {
+        for (c = 0; c < CHECK_STEPS; c++, steps++) {
+            i = rand() % n;
+            mm_free(live[i]);
+            if ((live[i] = mm_malloc(16 + rand() % 497)) == NULL)
+                app_error("mmsnap: out of heap");
+            memset(live[i], 0, 16);
+        }
+    } while (!mm_snapshot_wait(&snap, 0));
+    t_snap = clock_now() - start;
+    PERF_END("snapshot");
+    if (snap.copied_kb < 0)
+        app_error("mmsnap: the snapshot failed");
+
+    printf("snapshot  stopped %8.3f ms, done in %.3f ms, %ld allocations "
+           "meanwhile, %ld KB copied\n", t_fork * 1e3, t_snap * 1e3, steps,
+           snap.copied_kb);
+    if (mm_checkheap(0) != 0)
+        app_error("mmsnap: heap corrupted");
+    perf_report(stdout);
+    Free(live);
+    mem_deinit();
+    return 0;
+}
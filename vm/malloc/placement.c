@@ -0,0 +1,177 @@
+#include "common.h"
+#include "memlib.h"
+#include "vmsim.h"
+
+/**
+ * placement - How the placement of heap objects affects address
+ * translation. N objects of S bytes are taken from memlib's heap and
+ * written as they are, then K of them are read in a random order, with
+ * objects placed
+ *
+ *   packed      back to back, after one mem_sbrk for all of them
+ *   page        one per page, with a mem_sbrk each
+ *   chunk       back to back in 2 MB chunks, one mem_sbrk per chunk
+ *   aligned     the same, with chunks aligned to 2 MB
+ *
+ * with 4 KB pages only, then with transparent huge pages, and the default
+ * TLB of vmsim.h. For each it reports the page faults and page tables of
+ * the allocations, and the TLB miss rate and the page table entries read
+ * per access of the reads.
+ *
+ * memlib's heap starts on a 2 MB boundary, which a program's brk rarely
+ * does, so each run first moves the break half a chunk past it, and
+ * unmaps that half: only aligned then gets its chunks on 2 MB boundaries.
+ *
+ * usage: placement [-n N] [-s S] [-k K]
+ *                  (default: 4096 objects of 2048 bytes, 1000000 reads)
+ */
+#define CHUNK (1 << VM_HUGE_SHIFT)
+
+static char **objs;             /* The objects */
+static char *chunk, *chunk_end; /* What is left of the current chunk */
+
+/* Mem_sbrk - mem_sbrk that exits when the heap is full */
+static void *Mem_sbrk(int incr)
+{
+    void *p;
+
+    if ((p = mem_sbrk(incr)) == (void *)-1)
+        app_error("placement: heap full, try a smaller N or S");
+    return p;
+}
+
+/* touch - Writes the object of @size bytes at @p, a page at a time */
+static void touch(char *p, int size)
+{
+    char *end = p + size;
+
+    for (; p < end; p = (char *)(((uintptr_t)p | 4095) + 1))
+        vm_access((uintptr_t)p);
+}
+
+static void place_packed(int n, int size)
+{
+    char *p = Mem_sbrk(n * size);
+    int i;
+
+    for (i = 0; i < n; i++) {
+        objs[i] = p + i * size;
+        touch(objs[i], size);
+    }
+}
+
+static void place_page(int n, int size)
+{
+    size_t pagesize = mem_pagesize();
+    int i;
+
+    /* A page or more each, starting on a page boundary */
+    Mem_sbrk(-(uintptr_t)Mem_sbrk(0) & (pagesize - 1));
+    for (i = 0; i < n; i++) {
+        objs[i] = Mem_sbrk((size + pagesize - 1) & ~(pagesize - 1));
+        touch(objs[i], size);
+    }
+}
+
+/* place_chunks - Carves the objects out of chunks, aligned if @align */
+static void place_chunks(int n, int size, int align)
+{
+    int i;
+
+    if (align)
+        Mem_sbrk(-(uintptr_t)Mem_sbrk(0) & (CHUNK - 1));
+    chunk = chunk_end = NULL;
+    for (i = 0; i < n; i++) {
+        if (chunk_end - chunk < size) {
+            chunk = Mem_sbrk(CHUNK);
+            chunk_end = chunk + CHUNK;
+        }
+        objs[i] = chunk;
+        chunk += size;
+        touch(objs[i], size);
+    }
+}
+
+static void place_chunk(int n, int size)
+{
+    place_chunks(n, size, 0);
+}
+
+static void place_aligned(int n, int size)
+{
+    place_chunks(n, size, 1);
+}
+
+static void run(char *name, void (*place)(int, int), int thp, int n,
+                int size, long k)
+{
+    vm_config_t config = VM_CONFIG_DEFAULT;
+    vm_stats_t alloc, *s;
+    char *pad;
+    long i;
+
+    mem_reset_brk();
+    config.thp = thp;
+    vm_init(&config);
+    srand(1);
+
+    pad = Mem_sbrk(CHUNK / 2);
+    vm_unmap(pad, CHUNK / 2);
+
+    place(n, size);
+    alloc = *vm_stats();
+    for (i = 0; i < k; i++)
+        vm_access((uintptr_t)objs[rand() % n]);
+    s = vm_stats();
+
+    printf("%-8s %-4s %10lu %10lu %8lu %10.2f %12.2f\n", name,
+           thp ? "on" : "off", alloc.faults, alloc.huge_faults, alloc.tables,
+           100.0 * (s->walks - alloc.walks) / k,
+           (double)(s->walk_refs - alloc.walk_refs) / k);
+}
+
+int main(int argc, char **argv)
+{
+    static struct {
+        char *name;
+        void (*place)(int, int);
+    } policies[] = {
+        {"packed", place_packed},
+        {"page", place_page},
+        {"chunk", place_chunk},
+        {"aligned", place_aligned},
+    };
+    int c, i, thp, n = 4096, size = 2048;
+    long k = 1000000;
+
+    while ((c = getopt(argc, argv, "n:s:k:")) != -1) {
+        switch (c) {
+            case 'n':
+                n = atoi(optarg);
+                break;
+            case 's':
+                size = atoi(optarg);
+                break;
+            case 'k':
+                k = atol(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-n N] [-s S] [-k K]\n", argv[0]);
+                exit(1);
+        }
+    }
+    if (n <= 0 || size <= 0 || k <= 0)
+        app_error("placement: N, S and K must be positive");
+
+    mem_init();
+    objs = Malloc(n * sizeof(char *));
+    printf("%d objects of %d bytes, %ld reads\n", n, size, k);
+    printf("%-8s %-4s %10s %10s %8s %10s %12s\n", "policy", "THP", "faults 4K",
+           "faults 2M", "tables", "TLB miss%", "reads/access");
+    for (thp = 0; thp <= 1; thp++)
+        for (i = 0; i < sizeof(policies) / sizeof(policies[0]); i++)
+            run(policies[i].name, policies[i].place, thp, n, size, k);
+    vm_report(stdout);
+    Free(objs);
+    return 0;
+}
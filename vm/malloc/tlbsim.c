@@ -0,0 +1,88 @@
+#include "common.h"
+#include "trace.h"
+#include "vmsim.h"
+
+/**
+ * tlbsim - Replays a memory trace, binary or valgrind lackey text (see
+ * ../cache/trace.h), through the address translation model of vmsim.h and
+ * reports the TLB hits, page walks and page faults. The trace is of a
+ * whole program, so any address is taken as mapped: its pages are mapped
+ * in by their first access, as 2 MB pages with -T. A modify translates
+ * twice, like the load and the store it is.
+ *
+ * usage: tlbsim [-TP] [-l <levels>] [-t <sets>,<ways>] [-H <sets>,<ways>]
+ *               <tracefile>
+ *
+ * -t sizes the TLB of 4 KB entries, -H the one of 2 MB entries (0,0 for
+ * none), -l the page table (4 or 5 levels); the default is vmsim.h's. -P
+ * prints the performance counters of the simulation.
+ */
+
+static void usage(char *prog)
+{
+    fprintf(stderr, "usage: %s [-TP] [-l <levels>] [-t <sets>,<ways>] "
+            "[-H <sets>,<ways>] <tracefile>\n", prog);
+    exit(1);
+}
+
+/* translate - Translates the addresses of a reference */
+static void translate(int op, uint64_t addr, int size, void *arg)
+{
+    vm_access(addr);
+    if (op == 'M')
+        vm_access(addr);
+}
+
+int main(int argc, char **argv)
+{
+    vm_config_t config = VM_CONFIG_DEFAULT;
+    trace_file_t trace;
+    int c, pflag = 0;
+    double start, t;
+
+    config.demand = 1;
+    while ((c = getopt(argc, argv, "TPl:t:H:")) != -1) {
+        switch (c) {
+            case 'T':
+                config.thp = 1;
+                break;
+            case 'P':
+                pflag = 1;
+                break;
+            case 'l':
+                config.levels = atoi(optarg);
+                break;
+            case 't':
+                if (sscanf(optarg, "%d,%d", &config.tlb_sets,
+                           &config.tlb_ways) != 2)
+                    usage(argv[0]);
+                break;
+            case 'H':
+                if (sscanf(optarg, "%d,%d", &config.huge_sets,
+                           &config.huge_ways) != 2)
+                    usage(argv[0]);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1)
+        usage(argv[0]);
+
+    vm_init(&config);
+    trace_map(&trace, argv[optind]);
+    PERF_BEGIN("translate");
+    start = clock_now();
+    trace_replay(&trace, translate, NULL);
+    t = clock_now() - start;
+    PERF_END("translate");
+    trace_unmap(&trace);
+
+    vm_report(stdout);
+    printf("%lu translations in %.3f s, %.1f M/s\n", vm_stats()->accesses, t,
+           vm_stats()->accesses / t / 1e6);
+    if (pflag)
+        perf_report(stdout);
+    vm_free();
+    return 0;
+}
@@ -0,0 +1,400 @@
+#include "common.h"
+#include "vmsim.h"
+
+#define PT_BITS (9)
+#define PT_SIZE (1 << PT_BITS)      /* Entries of a page table */
+#define HUGE_BITS (VM_HUGE_SHIFT - VM_PAGE_SHIFT)
+#define MAX_RANGES (64)
+#define INVALID (~(uint64_t)0)      /* Tag of an empty TLB entry */
+
+/*
+ * A page table entry is 0 if nothing is mapped in under it. Otherwise it
+ * is PTE_PRESENT, plus PTE_HUGE for a 2 MB page, or the address of the
+ * next level's table plus PTE_PRESENT.
+ */
+#define PTE_PRESENT (1)
+#define PTE_HUGE (2)
+#define PTE_TABLE(e) ((uint64_t *)(uintptr_t)((e) & ~(uint64_t)3))
+#define PT_INDEX(vpn, level) ((vpn) >> (PT_BITS * (level)) & (PT_SIZE - 1))
+
+/* A TLB: sets of ways, page numbers most recently used first */
+typedef struct {
+    int sets, ways;
+    uint64_t *tags;
+} tlb_t;
+
+/* Mapped addresses, [start, end) */
+typedef struct {
+    uint64_t start, end;
+} range_t;
+
+/* Private global variables */
+static vm_config_t config;
+static vm_stats_t stats;
+static uint64_t *root;                  /* Top page table, NULL if no model */
+static tlb_t tlb, huge_tlb;
+static range_t ranges[MAX_RANGES];      /* Sorted, apart from each other */
+static int nranges;
+
+
+/*****************************************************************************************
+ * TLBs.
+ * ***************************************************************************************/
+static void tlb_init(tlb_t *t, int sets, int ways)
+{
+    int i;
+
+    t->sets = sets > 0 && ways > 0 ? sets : 0;
+    t->ways = ways;
+    t->tags = NULL;
+    if (t->sets == 0)
+        return;
+    t->tags = Malloc((size_t)sets * ways * sizeof(uint64_t));
+    for (i = 0; i < sets * ways; i++)
+        t->tags[i] = INVALID;
+}
+
+/* tlb_lookup - Returns 1 if page @pn is in @t, which makes it the MRU */
+static int tlb_lookup(tlb_t *t, uint64_t pn)
+{
+    uint64_t *set;
+    int i;
+
+    if (t->sets == 0)
+        return 0;
+    set = t->tags + (pn % t->sets) * t->ways;
+    for (i = 0; i < t->ways && set[i] != INVALID; i++) {
+        if (set[i] == pn) {
+            for (; i > 0; i--)
+                set[i] = set[i - 1];
+            set[0] = pn;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* tlb_insert - Caches page @pn in @t, evicting the LRU entry of its set */
+static void tlb_insert(tlb_t *t, uint64_t pn)
+{
+    uint64_t *set = t->tags + (pn % t->sets) * t->ways;
+    int i;
+
+    for (i = t->ways - 1; i > 0; i--)
+        set[i] = set[i - 1];
+    set[0] = pn;
+}
+
+/* tlb_drop - Drops the entries of pages @first to @last from @t */
+static void tlb_drop(tlb_t *t, uint64_t first, uint64_t last)
+{
+    uint64_t *set;
+    int s, i, j;
+
+    for (s = 0; s < t->sets; s++) {
+        set = t->tags + s * t->ways;
+        for (i = j = 0; i < t->ways; i++) {
+            if (set[i] != INVALID && set[i] >= first && set[i] <= last)
+                stats.shootdowns++;
+            else
+                set[j++] = set[i];
+        }
+        while (j < t->ways)
+            set[j++] = INVALID;
+    }
+}
+
+
+/*****************************************************************************************
+ * Mapped ranges.
+ * ***************************************************************************************/
+/* mapped - Returns 1 if all of [@start, @end) is mapped */
+static int mapped(uint64_t start, uint64_t end)
+{
+    int i;
+
+    if (config.demand)
+        return 1;
+    for (i = 0; i < nranges && ranges[i].start <= start; i++)
+        if (end <= ranges[i].end)
+            return 1;
+    return 0;
+}
+
+/* range_add - Adds [@start, @end) to the mapped ranges */
+static void range_add(uint64_t start, uint64_t end)
+{
+    int i, j;
+
+    /* The first range it touches, and the first one after it */
+    for (i = 0; i < nranges && ranges[i].end < start; i++)
+        ;
+    for (j = i; j < nranges && ranges[j].start <= end; j++) {
+        start = ranges[j].start < start ? ranges[j].start : start;
+        end = ranges[j].end > end ? ranges[j].end : end;
+    }
+    if (i == j && nranges == MAX_RANGES)
+        app_error("vm_map: too many mappings");
+    memmove(ranges + i + 1, ranges + j, (nranges - j) * sizeof(range_t));
+    nranges += i + 1 - j;
+    ranges[i].start = start;
+    ranges[i].end = end;
+}
+
+/* range_remove - Removes [@start, @end) from the mapped ranges */
+static void range_remove(uint64_t start, uint64_t end)
+{
+    range_t old[MAX_RANGES];
+    int i, n = nranges;
+
+    memcpy(old, ranges, n * sizeof(range_t));
+    nranges = 0;
+    for (i = 0; i < n; i++) {
+        if (old[i].start < start && nranges < MAX_RANGES) {
+            ranges[nranges].start = old[i].start;
+            ranges[nranges++].end = old[i].end < start ? old[i].end : start;
+        }
+        if (old[i].end > end && nranges < MAX_RANGES) {
+            ranges[nranges].start = old[i].start > end ? old[i].start : end;
+            ranges[nranges++].end = old[i].end;
+        }
+    }
+}
+
+
+/*****************************************************************************************
+ * Page tables.
+ * ***************************************************************************************/
+static uint64_t *table_new(void)
+{
+    stats.tables++;
+    return Calloc(PT_SIZE, sizeof(uint64_t));
+}
+
+/* table_free - Frees @table of level @level and the tables under it */
+static void table_free(uint64_t *table, int level)
+{
+    int i;
+
+    for (i = 0; level > 0 && i < PT_SIZE; i++)
+        if (table[i] & PTE_PRESENT && !(table[i] & PTE_HUGE))
+            table_free(PTE_TABLE(table[i]), level - 1);
+    Free(table);
+}
+
+/**
+ * walk - Walks the page table for page @vpn, reading one entry per level.
+ * Returns the leaf, or 0 if nothing is mapped in there.
+ */
+static uint64_t walk(uint64_t vpn)
+{
+    uint64_t *table = root, e;
+    int level;
+
+    for (level = config.levels - 1; ; level--) {
+        stats.walk_refs++;
+        e = table[PT_INDEX(vpn, level)];
+        if (!(e & PTE_PRESENT) || level == 0 || e & PTE_HUGE)
+            return e;
+        table = PTE_TABLE(e);
+    }
+}
+
+/**
+ * entry - Returns the entry for page @vpn at level @level (1 for 2 MB
+ * pages, 0 for 4 KB ones), creating the tables above it.
+ */
+static uint64_t *entry(uint64_t vpn, int level)
+{
+    uint64_t *table = root, *e;
+    int l;
+
+    for (l = config.levels - 1; l > level; l--) {
+        e = &table[PT_INDEX(vpn, l)];
+        if (*e == 0)
+            *e = (uintptr_t)table_new() | PTE_PRESENT;
+        table = PTE_TABLE(*e);
+    }
+    return &table[PT_INDEX(vpn, level)];
+}
+
+/* find - Like entry, but returns NULL if a table above is missing */
+static uint64_t *find(uint64_t vpn, int level)
+{
+    uint64_t *table = root, e;
+    int l;
+
+    for (l = config.levels - 1; l > level; l--) {
+        e = table[PT_INDEX(vpn, l)];
+        if (!(e & PTE_PRESENT) || e & PTE_HUGE)
+            return e ? &table[PT_INDEX(vpn, l)] : NULL;
+        table = PTE_TABLE(e);
+    }
+    return &table[PT_INDEX(vpn, level)];
+}
+
+/* fault - Maps in page @vpn. Returns the leaf */
+static uint64_t fault(uint64_t vpn)
+{
+    uint64_t *e, start = vpn >> HUGE_BITS << VM_HUGE_SHIFT;
+
+    /* A 2 MB page, unless part of it is mapped in as 4 KB pages already */
+    if (config.thp && mapped(start, start + (1 << VM_HUGE_SHIFT))) {
+        e = entry(vpn, 1);
+        if (*e == 0) {
+            stats.huge_faults++;
+            return *e = PTE_PRESENT | PTE_HUGE;
+        }
+    }
+    e = entry(vpn, 0);
+    stats.faults++;
+    return *e = PTE_PRESENT;
+}
+
+/* split - Turns the 2 MB page at *@e into 512 4 KB pages */
+static void split(uint64_t *e)
+{
+    uint64_t *table = table_new();
+    int i;
+
+    for (i = 0; i < PT_SIZE; i++)
+        table[i] = PTE_PRESENT;
+    *e = (uintptr_t)table | PTE_PRESENT;
+}
+
+
+/*****************************************************************************************
+ * The model.
+ * ***************************************************************************************/
+void vm_init(vm_config_t *c)
+{
+    static vm_config_t defaults = VM_CONFIG_DEFAULT;
+
+    vm_free();
+    config = c ? *c : defaults;
+    if ((config.levels != 4 && config.levels != 5) || config.tlb_sets <= 0
+        || config.tlb_ways <= 0)
+        app_error("vm_init: invalid configuration");
+    memset(&stats, 0, sizeof(stats));
+    root = table_new();
+    tlb_init(&tlb, config.tlb_sets, config.tlb_ways);
+    tlb_init(&huge_tlb, config.huge_sets, config.huge_ways);
+}
+
+void vm_free(void)
+{
+    if (root == NULL)
+        return;
+    table_free(root, config.levels - 1);
+    Free(tlb.tags);
+    if (huge_tlb.tags)
+        Free(huge_tlb.tags);
+    root = NULL;
+    nranges = 0;
+}
+
+void vm_map(void *start, size_t len)
+{
+    uint64_t mask = (1 << VM_PAGE_SHIFT) - 1;
+
+    if (root == NULL || len == 0)
+        return;
+    range_add((uintptr_t)start & ~mask, ((uintptr_t)start + len + mask) & ~mask);
+}
+
+void vm_unmap(void *start, size_t len)
+{
+    uint64_t mask = (1 << VM_PAGE_SHIFT) - 1;
+    uint64_t first, end, vpn, *e;
+
+    if (root == NULL || len == 0)
+        return;
+    first = (uintptr_t)start >> VM_PAGE_SHIFT;
+    end = ((uintptr_t)start + len + mask) >> VM_PAGE_SHIFT;
+    range_remove(first << VM_PAGE_SHIFT, end << VM_PAGE_SHIFT);
+
+    for (vpn = first; vpn < end; vpn++) {
+        if ((e = find(vpn, 1)) == NULL || *e == 0) {
+            vpn |= PT_SIZE - 1;         /* Nothing in this 2 MB */
+            continue;
+        }
+        if (*e & PTE_HUGE) {
+            /* All of it goes at once, or it is split */
+            if (vpn % PT_SIZE == 0 && vpn + PT_SIZE <= end) {
+                *e = 0;
+                vpn += PT_SIZE - 1;
+                continue;
+            }
+            split(e);
+        }
+        *find(vpn, 0) = 0;
+    }
+    tlb_drop(&tlb, first, end - 1);
+    tlb_drop(&huge_tlb, first >> HUGE_BITS, (end - 1) >> HUGE_BITS);
+}
+
+int vm_access(uint64_t addr)
+{
+    uint64_t vpn = addr >> VM_PAGE_SHIFT, e;
+    int r = VM_WALK;
+
+    if (root == NULL)
+        return VM_HIT;
+    stats.accesses++;
+
+    /* Both TLBs are looked up at once, a page is in one of them at most */
+    if (tlb_lookup(&tlb, vpn)) {
+        stats.hits++;
+        return VM_HIT;
+    }
+    if (tlb_lookup(&huge_tlb, vpn >> HUGE_BITS)) {
+        stats.huge_hits++;
+        return VM_HIT;
+    }
+
+    stats.walks++;
+    if ((e = walk(vpn)) == 0) {
+        if (!mapped(vpn << VM_PAGE_SHIFT, (vpn + 1) << VM_PAGE_SHIFT)) {
+            stats.invalid++;
+            return VM_INVALID;
+        }
+        e = fault(vpn);
+        r = VM_FAULT;
+    }
+
+    /* Without 2 MB entries, a 2 MB page is cached in 4 KB pieces */
+    if (e & PTE_HUGE && huge_tlb.sets)
+        tlb_insert(&huge_tlb, vpn >> HUGE_BITS);
+    else
+        tlb_insert(&tlb, vpn);
+    return r;
+}
+
+vm_stats_t *vm_stats(void)
+{
+    return &stats;
+}
+
+void vm_report(FILE *fp)
+{
+    unsigned long misses = stats.walks;
+
+    fprintf(fp, "vm: %d-level page table, TLB %dx%d 4 KB", config.levels,
+            config.tlb_sets, config.tlb_ways);
+    if (huge_tlb.sets)
+        fprintf(fp, " + %dx%d 2 MB", huge_tlb.sets, huge_tlb.ways);
+    fprintf(fp, " entries, reach %lu KB, THP %s%s\n",
+            (unsigned long)tlb.sets * tlb.ways * 4
+            + (unsigned long)huge_tlb.sets * huge_tlb.ways * 2048,
+            config.thp ? "on" : "off", config.demand ? ", demand paging" : "");
+    fprintf(fp, "accesses %lu  TLB hits %lu (4 KB) %lu (2 MB)  misses %lu "
+            "(%.2f%%)\n", stats.accesses, stats.hits, stats.huge_hits, misses,
+            stats.accesses ? 100.0 * misses / stats.accesses : 0);
+    fprintf(fp, "walks %lu  entries read %lu (%.2f per walk)  "
+            "invalid %lu\n", stats.walks, stats.walk_refs,
+            stats.walks ? (double)stats.walk_refs / stats.walks : 0,
+            stats.invalid);
+    fprintf(fp, "page faults %lu (4 KB) %lu (2 MB)  page tables %lu (%lu KB)  "
+            "shootdowns %lu\n", stats.faults, stats.huge_faults, stats.tables,
+            stats.tables * 4, stats.shootdowns);
+}
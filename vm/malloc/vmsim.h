@@ -0,0 +1,94 @@
+/*****************************************************************************************
+ * vmsim.h - A model of address translation.
+ *
+ * Translates the addresses of memlib's heap, or of a trace, the way an
+ * x86-64 MMU does: a TLB of 4 KB entries and one of 2 MB entries are
+ * looked up together; on a miss, the page table, a radix tree of 512-entry
+ * tables (4 levels for 48-bit addresses, 5 for 57-bit), is walked from the
+ * root, one entry read per level, 2 MB pages stopping a level early. A
+ * walk that finds no page is a page fault: the page is mapped in if the
+ * address is mapped, as a 2 MB page if transparent huge pages are on and
+ * the whole aligned 2 MB around it is mapped and not yet in 4 KB pages;
+ * otherwise the access is invalid, a segmentation fault.
+ *
+ * What is mapped is what mem_sbrk hands out, as vm_map is called for it,
+ * or any address in demand mode, for traces of whole programs.
+ ****************************************************************************************/
+#ifndef __VMSIM_H__
+#define __VMSIM_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define VM_PAGE_SHIFT (12)
+#define VM_HUGE_SHIFT (21)
+
+typedef struct {
+    int levels;                 /* Of the page table, 4 or 5 */
+    int tlb_sets, tlb_ways;     /* 4 KB entries */
+    int huge_sets, huge_ways;   /* 2 MB entries, 0 for none */
+    int thp;                    /* Map 2 MB pages where possible */
+    int demand;                 /* Any address is mapped */
+} vm_config_t;
+
+typedef struct {
+    unsigned long accesses;
+    unsigned long hits;         /* In the 4 KB TLB */
+    unsigned long huge_hits;    /* In the 2 MB TLB */
+    unsigned long walks;        /* TLB misses */
+    unsigned long walk_refs;    /* Page table entries read by the walks */
+    unsigned long faults;       /* 4 KB pages mapped in */
+    unsigned long huge_faults;  /* 2 MB pages mapped in */
+    unsigned long invalid;      /* Accesses to unmapped addresses */
+    unsigned long tables;       /* Page tables allocated */
+    unsigned long shootdowns;   /* TLB entries dropped by vm_unmap */
+} vm_stats_t;
+
+/* The default: a Skylake-like L1 dTLB with 64 + 32 entries, 4 levels */
+#define VM_CONFIG_DEFAULT {4, 16, 4, 8, 4, 0, 0}
+
+/**
+ * vm_init - Starts a model with configuration @config, or the default if
+ * NULL, and no page mapped in. A previous model is freed.
+ */
+void vm_init(vm_config_t *config);
+
+/**
+ * vm_free - Frees the page tables and TLBs. vm_map and vm_unmap do nothing
+ * until the next vm_init.
+ */
+void vm_free(void);
+
+/**
+ * vm_map - Maps the pages of [@start, @start + @len). Pages are mapped in
+ * on their first access, like the anonymous memory of a heap.
+ */
+void vm_map(void *start, size_t len);
+
+/**
+ * vm_unmap - Unmaps the pages of [@start, @start + @len) and drops their
+ * TLB entries. Huge pages that are partly unmapped are split.
+ */
+void vm_unmap(void *start, size_t len);
+
+/**
+ * vm_access - Translates @addr.
+ *
+ * @return VM_HIT, VM_WALK if the page table was walked, VM_FAULT if the
+ * page had to be mapped in, VM_INVALID if it is not mapped.
+ */
+int vm_access(uint64_t addr);
+enum { VM_HIT, VM_WALK, VM_FAULT, VM_INVALID };
+
+/**
+ * vm_stats - Returns the counts since vm_init.
+ */
+vm_stats_t *vm_stats(void);
+
+/**
+ * vm_report - Prints the configuration, the counts and the TLB reach to
+ * @fp.
+ */
+void vm_report(FILE *fp);
+
+#endif /* __VMSIM_H__ */